@@ -7,11 +7,16 @@
 
 using namespace std;
 
+namespace llvm {
+class Function;
+}
+
 class CodeGenContext;
 class NBlock;
 class NStatement;
 class NExpression;
 class NVariableDeclaration;
+class NFunctionDeclaration;
 
 typedef vector<NStatement *> StatementList;
 typedef vector<NExpression *> ExpressionList;
@@ -19,6 +24,9 @@ typedef vector<NVariableDeclaration *> VariableList;
 
 class Node {
 public:
+    int line = 0; /* source line, 0 if unknown */
+    int column = 0;
+
     Node()
     {
     }
@@ -88,6 +96,7 @@ public:
     string name;
     bool isType = false;
     bool isPtr = false;
+    NVariableDeclaration *decl = nullptr; /* bound by Sema */
 
     void print()
     {
@@ -107,6 +116,11 @@ class NMethodCall : public NExpression {
 public:
     const NIdentifier *id;
     ExpressionList *arguments;
+    NFunctionDeclaration *callee = nullptr; /* bound by Sema */
+    /* parallel_for(lo, hi, body): body, bound by Sema, callee stays null */
+    NFunctionDeclaration *parallelBody = nullptr;
+    bool isFolded = false; /* evaluated at compile time by ConstEvaluator */
+    long long foldedValue = 0;
 
     void print()
     {
@@ -227,6 +241,7 @@ public:
     const NIdentifier *type;
     NIdentifier *id;
     NExpression *assignmentExpr = nullptr;
+    llvm::Value *storage = nullptr; /* the alloca, set by codegen */
 
     void print()
     {
@@ -251,6 +266,9 @@ public:
     VariableList *arguments;
     NBlock *block = NULL;
     bool isExtern = false;
+    bool isVarArg = false;
+    vector<string> attributes; /* __attribute__((...)) names */
+    llvm::Function *function = nullptr; /* set by declare() */
 
     void print()
     {
@@ -272,6 +290,8 @@ public:
         print();
     }
 
+    /* Create (or reuse) the llvm::Function, without the body */
+    llvm::Function *declare(CodeGenContext &context);
     virtual llvm::Value *codeGen(CodeGenContext &context);
 };
 
@@ -0,0 +1,64 @@
+/*
+ * Times int kernel(int), linked from a c2ir or clang object. Prints the
+ * median and the fastest of the repeated runs, in ns per call, the number
+ * of calls made, the warm up included, and the sum of their results, which
+ * every build of a kernel must agree on.
+ *
+ *   ./bench [iterations [repeats]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern int kernel(int n);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 5;
+    long warmup = iterations / 10;
+    unsigned checksum = 0; /* wraps, unlike an int */
+    double *times;
+    int r;
+
+    if (iterations <= 0 || repeats <= 0) {
+        fprintf(stderr, "usage: %s [iterations [repeats]]\n", argv[0]);
+        return 1;
+    }
+    times = malloc(repeats * sizeof(*times));
+
+    /* Warm up caches and the branch predictors */
+    for (long i = 0; i < warmup; i++)
+        checksum += kernel(i);
+
+    for (r = 0; r < repeats; r++) {
+        double start = now();
+        unsigned sum = 0;
+
+        for (long i = 0; i < iterations; i++)
+            sum += kernel(i);
+        checksum += sum;
+        times[r] = (now() - start) / iterations;
+    }
+
+    qsort(times, repeats, sizeof(*times), compare);
+    printf("%.3f %.3f %ld %u\n", times[repeats / 2], times[0],
+           warmup + iterations * repeats, checksum);
+    free(times);
+    return 0;
+}
@@ -0,0 +1,52 @@
+int step1(int x)
+{
+    return x + 3;
+}
+
+int step2(int x)
+{
+    int y = step1(x);
+    return y - 1;
+}
+
+int step3(int x)
+{
+    int y = step2(x);
+    return y + step1(y);
+}
+
+int step4(int x)
+{
+    int y = step3(x);
+    return y - step2(x);
+}
+
+int step5(int x)
+{
+    int y = step4(x);
+    return y + step3(y);
+}
+
+int step6(int x)
+{
+    int y = step5(x);
+    return y - step4(x);
+}
+
+int step7(int x)
+{
+    int y = step6(x);
+    return y + step5(y);
+}
+
+int step8(int x)
+{
+    int y = step7(x);
+    return y - step6(x);
+}
+
+int kernel(int n)
+{
+    int a = step8(n);
+    return a + step7(n);
+}
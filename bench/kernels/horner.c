@@ -0,0 +1,33 @@
+int times10(int x)
+{
+    int x2 = x + x;
+    int x4 = x2 + x2;
+    int x8 = x4 + x4;
+    return x8 + x2;
+}
+
+int horner(int acc, int n)
+{
+    int t = times10(acc);
+    return t + n;
+}
+
+int kernel(int n)
+{
+    int acc = n;
+
+    acc = horner(acc, n);
+    acc = horner(acc, 3);
+    acc = horner(acc, n);
+    acc = horner(acc, 7);
+    acc = horner(acc, n);
+    acc = horner(acc, 1);
+    acc = horner(acc, n);
+    acc = horner(acc, 5);
+    acc = horner(acc, n);
+    acc = horner(acc, 9);
+    acc = horner(acc, n);
+    acc = horner(acc, 2);
+
+    return acc;
+}
@@ -0,0 +1,40 @@
+int kernel(int n)
+{
+    int a = n;
+    int b = 1;
+
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+    a = a + b;
+    b = b + a;
+
+    return a - b;
+}
@@ -0,0 +1,24 @@
+int kernel(int n)
+{
+    int a = n + 1;
+    int b = n + 1;
+    int c = a + b;
+    int d = a + b;
+    int dead = c - d;
+    int e = c + d;
+
+    dead = e + 5;
+    dead = e - 5;
+    a = n + 1;
+    b = a + b;
+    c = b + c;
+    d = c + d;
+    e = d + e;
+    a = e - a;
+    b = a - b;
+    c = b - c;
+    d = c - d;
+    e = d - e;
+
+    return e + a;
+}
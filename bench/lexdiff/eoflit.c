@@ -0,0 +1 @@
+char *s = "abc
\ No newline at end of file
@@ -0,0 +1 @@
+int café = 1;
@@ -0,0 +1,17 @@
+extern int printf(const char *str, ...);
+
+int a_very_long_identifier_crossing_two_avx2_vectors_0123456789(int x)
+{
+	int		y = 12345678901234567890123456789012345678 + x;
+    char *s = "a literal which is longer than thirty two bytes, 100%  = $!.\\";
+                                        
+																			return y;
+}
+int f123abc(int x123)
+{
+    return 123abc;
+}
+int externx(int constant)
+{
+    return __attribute__x;
+}
@@ -0,0 +1,132 @@
+#!/bin/sh
+#
+# Generated-code benchmark: every kernel in kernels/ is compiled by c2ir at
+# -O0 to -O3 and by clang at -O0 and -O2, linked against driver.c and timed.
+#
+#   recurrence  a long dependency chain of adds through two locals
+#   callchain   a deep chain of small calls, inlining removes it
+#   horner      a polynomial by Horner's rule, multiplication by doubling
+#   redundant   repeated subexpressions and dead stores through locals
+#
+# For each build it reports the median ns per call, its ratio to clang -O2,
+# the .text size and the instruction count of the kernel object, and the
+# instructions retired per call when perf is available. It fails when the
+# results of a build differ from those of clang -O0.
+#
+#   ./run.sh [iterations [repeats]]
+#
+# C2IR, BENCH_CC (the C compiler, clang by default), RUNTIME (libc2ir_rt.a)
+# and OUT may be set in the environment. CC is not read: make exports its
+# own, the C++ compiler.
+
+set -e
+
+cd "$(dirname "$0")"
+
+C2IR=${C2IR:-$(pwd)/../c2ir}
+CC=${BENCH_CC:-clang}
+RUNTIME=${RUNTIME:-$(pwd)/../libc2ir_rt.a}
+OUT=${OUT:-out}
+KERNELS=$(pwd)/kernels
+ITERATIONS=${1:-10000000}
+REPEATS=${2:-5}
+
+if [ ! -x "$C2IR" ]; then
+    echo "$C2IR not found, run make first" >&2
+    exit 1
+fi
+
+mkdir -p "$OUT"
+$CC -O2 -c driver.c -o "$OUT/driver.o"
+
+if command -v perf > /dev/null 2>&1 &&
+    perf stat -x, -e instructions:u true > /dev/null 2>&1; then
+    PERF=perf
+fi
+
+# text_size obj: bytes in the .text sections, -ffunction-sections included
+text_size()
+{
+    size -A "$1" | awk '$1 ~ /^\.text/ { s += $2 } END { print s + 0 }'
+}
+
+# insn_count obj: instructions in the disassembly
+insn_count()
+{
+    objdump -d "$1" | grep -c '^ *[0-9a-f]*:	' || true
+}
+
+# retired bin: instructions retired per call, the driver loop included. The
+# counter also sees the warm up, so it is divided by all the calls made.
+retired()
+{
+    if [ -z "$PERF" ]; then
+        echo "-"
+        return
+    fi
+    calls=$(perf stat -x, -o "$OUT/perf.csv" -e instructions:u \
+        "$1" "$ITERATIONS" 1 | cut -d' ' -f3)
+    awk -F, -v n="$calls" '/instructions/ { printf "%.1f", $1 / n }' \
+        "$OUT/perf.csv"
+}
+
+# build kernel name: compile kernels/$kernel.c to $OUT/$kernel.$name.o
+build()
+{
+    obj="$OUT/$1.$2.o"
+    case $2 in
+    c2ir-O*)
+        # c2ir always writes text.o next to where it runs
+        (cd "$OUT" && "$C2IR" -${2#c2ir-} "$KERNELS/$1.c" > "$1.$2.log" 2>&1 &&
+            mv text.o "$1.$2.o") || {
+            echo "$C2IR failed on $1.c, see $OUT/$1.$2.log" >&2
+            exit 1
+        }
+        ;;
+    clang-O*)
+        # c2ir's int arithmetic wraps and the kernels overflow, make clang's
+        # defined the same way so that their checksums compare
+        $CC -${2#clang-} -fwrapv -c "kernels/$1.c" -o "$obj"
+        ;;
+    esac
+    $CC -o "$OUT/$1.$2" "$OUT/driver.o" "$obj" "$RUNTIME" -lpthread
+}
+
+BUILDS="c2ir-O0 c2ir-O1 c2ir-O2 c2ir-O3 clang-O0 clang-O2"
+
+printf "%-12s %-10s %10s %8s %8s %8s %10s\n" \
+    kernel build "ns/call" "vs O2" "bytes" insns "retired"
+
+for src in kernels/*.c; do
+    kernel=$(basename "$src" .c)
+
+    for b in $BUILDS; do
+        build "$kernel" "$b"
+    done
+
+    # Every build must compute what clang -O0 does, a miscompile isn't fast
+    ref=$("$OUT/$kernel.clang-O0" "$ITERATIONS" "$REPEATS")
+    o2=$("$OUT/$kernel.clang-O2" "$ITERATIONS" "$REPEATS")
+    base=$(echo "$o2" | cut -d' ' -f1)
+    refsum=$(echo "$ref" | cut -d' ' -f4)
+
+    for b in $BUILDS; do
+        case $b in
+        clang-O0) result=$ref ;;
+        clang-O2) result=$o2 ;;
+        *) result=$("$OUT/$kernel.$b" "$ITERATIONS" "$REPEATS") ;;
+        esac
+        sum=$(echo "$result" | cut -d' ' -f4)
+        if [ "$sum" != "$refsum" ]; then
+            echo "$kernel.$b: checksum $sum, clang-O0 gives $refsum" >&2
+            exit 1
+        fi
+        ns=$(echo "$result" | cut -d' ' -f1)
+        printf "%-12s %-10s %10s %8s %8s %8s %10s\n" \
+            "$kernel" "$b" "$ns" \
+            "$(awk -v a="$ns" -v b="$base" 'BEGIN { printf "%.2fx", a / b }')" \
+            "$(text_size "$OUT/$kernel.$b.o")" \
+            "$(insn_count "$OUT/$kernel.$b.o")" \
+            "$(retired "$OUT/$kernel.$b")"
+    done
+done
@@ -0,0 +1,81 @@
+/*
+ * Runs a command repeatedly, its output thrown away, and prints the median
+ * and the fastest wall time from fork to exit, in ms.
+ *
+ *   ./spawn runs command [args...]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int run(char **argv)
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 2 ? atoi(argv[1]) : 0;
+    double *times;
+    int r;
+
+    if (runs <= 0) {
+        fprintf(stderr, "usage: %s runs command [args...]\n", argv[0]);
+        return 1;
+    }
+    times = malloc(runs * sizeof(*times));
+
+    /* Warm up the page cache */
+    if (run(argv + 2)) {
+        fprintf(stderr, "%s failed\n", argv[2]);
+        return 1;
+    }
+
+    for (r = 0; r < runs; r++) {
+        double start = now();
+
+        if (run(argv + 2)) {
+            fprintf(stderr, "%s failed\n", argv[2]);
+            return 1;
+        }
+        times[r] = now() - start;
+    }
+
+    qsort(times, runs, sizeof(*times), compare);
+    printf("%.3f %.3f\n", times[runs / 2], times[0]);
+    free(times);
+    return 0;
+}
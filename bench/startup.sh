@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Startup-latency benchmark: c2ir compiles trivial.c, a main returning 0, so
+# the run is dominated by process startup, LLVM initialization and the
+# target setup rather than by the compile itself.
+#
+#   object   write text.o for the default target
+#   O2       the same through the -O2 pipeline
+#   jit      run it with -jit instead
+#
+# For each it reports the median and the fastest wall time of the runs, from
+# fork to exit. It also reports the relocations and the time of the dynamic
+# loader at startup, from LD_DEBUG=statistics (glibc), and the symbols c2ir
+# exports.
+#
+#   ./startup.sh [runs]
+#
+# C2IR, BENCH_CC (the C compiler, cc by default) and OUT may be set in the
+# environment. CC is not read: make exports its own, the C++ compiler.
+
+set -e
+
+cd "$(dirname "$0")"
+
+C2IR=${C2IR:-$(pwd)/../c2ir}
+CC=${BENCH_CC:-cc}
+OUT=${OUT:-startup.out}
+RUNS=${1:-50}
+
+if [ ! -x "$C2IR" ]; then
+    echo "$C2IR not found, run make first" >&2
+    exit 1
+fi
+
+mkdir -p "$OUT"
+$CC -O2 -o "$OUT/spawn" spawn.c
+cp trivial.c "$OUT/"
+
+# c2ir writes text.o next to where it runs
+cd "$OUT"
+
+printf "%-8s %10s %10s\n" mode "median ms" "min ms"
+for mode in object O2 jit; do
+    case $mode in
+    object) flags= ;;
+    O2) flags=-O2 ;;
+    jit) flags=-jit ;;
+    esac
+    # shellcheck disable=SC2086
+    ./spawn "$RUNS" "$C2IR" $flags trivial.c |
+        awk -v m="$mode" '{ printf "%-8s %10s %10s\n", m, $1, $2 }'
+done
+
+echo
+LD_DEBUG=statistics "$C2IR" trivial.c 2>&1 > /dev/null |
+    awk -F': *' '/total startup time in dynamic loader/ {
+                     print "dynamic loader time: " $3 }
+                 /[^l] number of relocations:/ { print "relocations: " $3 }
+                 /relative relocations:/ { print "relative relocations: " $3 }'
+echo "exported symbols: $(nm -D --defined-only "$C2IR" | wc -l)"
@@ -11,8 +11,9 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/CallingConv.h>
 #include <llvm/IR/IRPrintingPasses.h>
+#include <llvm/IR/DIBuilder.h>
 
-#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <llvm/Bitstream/BitstreamReader.h>
@@ -22,6 +23,7 @@
 #include <llvm/ExecutionEngine/MCJIT.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 
+#include <algorithm>
 #include <stack>
 #include <vector>
 #include <memory>
@@ -30,6 +32,9 @@
 
 #include "ASTnode.hpp"
 #include "parser.hpp"
+#include "perfjit.hpp"
+#include "targets.hpp"
+#include "runtime/c2ir_rt.h"
 
 using namespace llvm;
 using legacy::PassManager;
@@ -38,9 +43,8 @@ class CodeGenBlock {
 public:
     BasicBlock *block;
     Value *returnValue;
-    std::map<string, NIdentifier *> types;
     std::map<string, bool> isFuncArg;
-    std::map<string, Value *> locals;
+    DIScope *scope = nullptr;
 };
 
 class CodeGenContext {
@@ -52,20 +56,116 @@ public:
     IRBuilder<> builder;
     Module *module;
 
+    /* Debug info, only set up by initDebugInfo() */
+    std::unique_ptr<DIBuilder> dbuilder;
+    DICompileUnit *dcu = nullptr;
+
+    /* Register the perf listeners when running with the JIT */
+    bool perfJITEvents = false;
+
+    /* parallel_for body -> its outlined worker */
+    std::map<Function *, Function *> parallelWorkers;
+
+    /* Lower echo, printf and puts to the runtime/io.c writers */
+    bool bufferedIO = true;
+
+    /* The definitions callees first, Sema::postOrder() */
+    vector<NFunctionDeclaration *> functionOrder;
+
     CodeGenContext()
         : builder(llvmContext)
     {
         module = new Module("main", llvmContext);
     }
 
-    BasicBlock *currentBlock()
+    /*
+     * With emit false, the locations are only tracked in the IR, for the
+     * optimization remarks, and no debug info is written to the object.
+     */
+    void initDebugInfo(const string &filename, bool emit = true)
     {
-        return blocks.top()->block;
+        module->addModuleFlag(Module::Warning, "Debug Info Version",
+                              DEBUG_METADATA_VERSION);
+        module->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+
+        dbuilder = std::make_unique<DIBuilder>(*module);
+        dcu = dbuilder->createCompileUnit(dwarf::DW_LANG_C,
+                                          dbuilder->createFile(filename, "."),
+                                          "c2ir", false, "", 0, StringRef(),
+                                          emit ? DICompileUnit::FullDebug
+                                               : DICompileUnit::NoDebug);
+    }
+
+    void finalizeDebugInfo()
+    {
+        if (dbuilder)
+            dbuilder->finalize();
     }
 
-    std::map<std::string, Value *> &locals()
+    /* Attach the source location of node to the instructions emitted next */
+    void emitLocation(const Node *node)
     {
-        return blocks.top()->locals;
+        if (!dbuilder || blocks.empty() || !blocks.top()->scope || !node->line)
+            return;
+        builder.SetCurrentDebugLocation(DILocation::get(
+            llvmContext, node->line, node->column, blocks.top()->scope));
+    }
+
+    void setCurrentScope(DIScope *scope)
+    {
+        blocks.top()->scope = scope;
+    }
+
+    /* Declare every function first, calls may come before definitions */
+    void declareFunctions(NBlock &root)
+    {
+        for (auto stmt : *root.statements)
+            if (auto func = dynamic_cast<NFunctionDeclaration *>(stmt))
+                func->declare(*this);
+    }
+
+    /*
+     * The core echo calls into libc2ir_rt.a, leave it out of the programs
+     * which don't call it, so that they link without the runtime.
+     */
+    void dropUnusedCoreFunctions()
+    {
+        Function *echo = module->getFunction("echo");
+        if (echo && echo->hasInternalLinkage() && echo->use_empty())
+            echo->eraseFromParent();
+    }
+
+    /*
+     * Declare every function in source order, then emit the extern
+     * prototypes and the bodies in the order of functionOrder, when given,
+     * and lay the bodies out in the module, and the object, in that order.
+     */
+    void emitProgram(NBlock &root)
+    {
+        declareFunctions(root);
+        if (functionOrder.empty()) {
+            root.codeGen(*this);
+            return;
+        }
+
+        for (auto stmt : *root.statements) {
+            auto func = dynamic_cast<NFunctionDeclaration *>(stmt);
+            if (func && func->isExtern)
+                func->codeGen(*this);
+        }
+        for (auto func : functionOrder) {
+            emitLocation(func);
+            func->codeGen(*this);
+        }
+        for (auto func : functionOrder) {
+            func->function->removeFromParent();
+            module->getFunctionList().push_back(func->function);
+        }
+    }
+
+    BasicBlock *currentBlock()
+    {
+        return blocks.top()->block;
     }
 
     void pushBlock(BasicBlock *block)
@@ -115,12 +215,14 @@ public:
 
         cout << "After push Block" << endl;
 
-        root.codeGen(*this); /* emit bytecode for the toplevel block */
+        emitProgram(root); /* emit bytecode for the toplevel block */
+        dropUnusedCoreFunctions();
 
         cout << "After code gen" << endl;
 
         //ReturnInst::Create(llvmContext, bblock);
         popBlock();
+        finalizeDebugInfo();
 
         /*
          * Print the bytecode in a human-readable format 
@@ -137,9 +239,10 @@ public:
 
     /* 
      * Build and run
-     * Executes the AST by running the main function
+     * Executes the AST by running the main function, fails if there is
+     * none or the JIT can't be created
      */
-    GenericValue generateAndRunCode(NBlock &root)
+    bool generateAndRunCode(NBlock &root)
     {
         cout << "Generating code..." << endl;
 
@@ -148,7 +251,7 @@ public:
         FunctionType *ftype = FunctionType::get(Type::getInt32Ty(llvmContext),
                                                 makeArrayRef(argTypes), false);
         mainFunction = Function::Create(ftype, GlobalValue::ExternalLinkage,
-                                        "main", module);
+                                        "main" /*, module */);
         BasicBlock *bblock =
             BasicBlock::Create(llvmContext, "entry", mainFunction, 0);
 
@@ -159,12 +262,23 @@ public:
 
         cout << "After push Block" << endl;
 
-        root.codeGen(*this); /* emit bytecode for the toplevel block */
+        emitProgram(root); /* emit bytecode for the toplevel block */
+        dropUnusedCoreFunctions();
 
         cout << "After code gen" << endl;
 
-        ReturnInst::Create(llvmContext, bblock);
+        ReturnInst::Create(
+            llvmContext, ConstantInt::get(Type::getInt32Ty(llvmContext), 0),
+            bblock);
         popBlock();
+        finalizeDebugInfo();
+
+        /* Sema rejects top level statements, only the program's main runs */
+        Function *entry = module->getFunction("main");
+        if (!entry || entry->isDeclaration()) {
+            errs() << "no main function to run\n";
+            return false;
+        }
 
         cout << "Code is generated." << endl;
         cout << "----------------------" << endl;
@@ -174,13 +288,46 @@ public:
         pm.run(*module);
 
         cout << "Running code..." << endl;
-        ExecutionEngine *ee =
-            EngineBuilder(unique_ptr<Module>(module)).create();
+        addRuntimeSymbols();
+        ensureNativeTarget();
+        std::string error;
+        ExecutionEngine *ee = EngineBuilder(unique_ptr<Module>(module))
+                                  .setErrorStr(&error)
+                                  .create();
+        if (!ee) {
+            errs() << "can't create the execution engine: " << error << "\n";
+            return false;
+        }
+        if (perfJITEvents)
+            registerPerfListeners(ee);
         ee->finalizeObject();
         vector<GenericValue> noargs;
-        GenericValue v = ee->runFunction(mainFunction, noargs);
+        /* The program writes to fd 1 directly, keep the trace in order */
+        cout.flush();
+        outs().flush();
+        ee->runFunction(entry, noargs);
+        c2ir_flush_all();
         cout << "Code was run." << endl;
-        return v;
+        return true;
+    }
+
+    /* The runtime is linked into c2ir, resolve the program's calls to it */
+    static void addRuntimeSymbols()
+    {
+        static const struct {
+            const char *name;
+            void *address;
+        } symbols[] = {
+            { "c2ir_parallel_for", (void *)&c2ir_parallel_for },
+            { "c2ir_write", (void *)&c2ir_write },
+            { "c2ir_write_str", (void *)&c2ir_write_str },
+            { "c2ir_write_char", (void *)&c2ir_write_char },
+            { "c2ir_write_int", (void *)&c2ir_write_int },
+            { "c2ir_puts", (void *)&c2ir_puts },
+            { "c2ir_printf", (void *)&c2ir_printf },
+        };
+        for (auto &symbol : symbols)
+            sys::DynamicLibrary::AddSymbol(symbol.name, symbol.address);
     }
 
     /* Returns an LLVM type based on the identifier */
@@ -199,21 +346,78 @@ public:
         return Type::getVoidTy(llvmContext);
     }
 
-    Value *getSymbolValue(string name) const
+    /*
+     * Lower a source level __attribute__ to LLVM function attributes.
+     * hot and cold also move the function to .text.hot/.text.unlikely.
+     * Sema::checkAttributes() rejected any other attribute.
+     */
+    void addFunctionAttribute(Function *function, const string &attr)
     {
-        if (blocks.top()->locals.find(name) != blocks.top()->locals.end())
-            return blocks.top()->locals[name];
-        return nullptr;
+        if (attr == "hot") {
+            function->addFnAttr(Attribute::InlineHint);
+            function->setSectionPrefix(".hot");
+        } else if (attr == "cold") {
+            function->addFnAttr(Attribute::Cold);
+            function->addFnAttr(Attribute::OptimizeForSize);
+            function->setSectionPrefix(".unlikely");
+        } else if (attr == "optsize") {
+            function->addFnAttr(Attribute::OptimizeForSize);
+        } else if (attr == "minsize") {
+            function->addFnAttr(Attribute::OptimizeForSize);
+            function->addFnAttr(Attribute::MinSize);
+        } else if (attr == "noinline") {
+            function->addFnAttr(Attribute::NoInline);
+        } else if (attr == "always_inline") {
+            function->addFnAttr(Attribute::AlwaysInline);
+        }
     }
 
-    void setSymbolValue(string name, Value *value)
+    /*
+     * Lower parallel_for(lo, hi, body): outline body into a worker running
+     * it over a subrange, once per body, and hand the worker to the
+     * runtime/parallel.c pool.
+     */
+    Value *emitParallelFor(Value *lo, Value *hi, Function *body)
     {
-        blocks.top()->locals[name] = value;
-    }
+        Type *int32Ty = Type::getInt32Ty(llvmContext);
+        FunctionType *workerType = FunctionType::get(
+            Type::getVoidTy(llvmContext), { int32Ty, int32Ty }, false);
+
+        Function *&worker = parallelWorkers[body];
+        if (!worker) {
+            worker = Function::Create(workerType, GlobalValue::InternalLinkage,
+                                      body->getName() + ".pfor", module);
+            Function::arg_iterator args = worker->arg_begin();
+            Argument *begin = &*args++;
+            Argument *end = &*args;
+            begin->setName("begin");
+            end->setName("end");
+
+            /* for (i = begin; i < end; i++) body(i); */
+            BasicBlock *entry =
+                BasicBlock::Create(llvmContext, "entry", worker);
+            BasicBlock *loop = BasicBlock::Create(llvmContext, "loop", worker);
+            BasicBlock *exit = BasicBlock::Create(llvmContext, "exit", worker);
+            IRBuilder<> b(entry);
+            b.CreateCondBr(b.CreateICmpSLT(begin, end), loop, exit);
+
+            b.SetInsertPoint(loop);
+            PHINode *i = b.CreatePHI(int32Ty, 2, "i");
+            i->addIncoming(begin, entry);
+            b.CreateCall(body, { i });
+            Value *next =
+                b.CreateNSWAdd(i, ConstantInt::get(int32Ty, 1), "next");
+            i->addIncoming(next, loop);
+            b.CreateCondBr(b.CreateICmpEQ(next, end), exit, loop);
+
+            b.SetInsertPoint(exit);
+            b.CreateRetVoid();
+        }
 
-    void setSymbolType(string name, NIdentifier *value)
-    {
-        blocks.top()->types[name] = value;
+        FunctionCallee parallelFor = module->getOrInsertFunction(
+            "c2ir_parallel_for", int32Ty, int32Ty, int32Ty,
+            PointerType::getUnqual(workerType));
+        return builder.CreateCall(parallelFor, { lo, hi, worker });
     }
 
     void setFuncArg(string name, bool value)
@@ -269,7 +473,8 @@ Value *NInteger::codeGen(CodeGenContext &context)
 Value *NLiteral::codeGen(CodeGenContext &context)
 {
     cout << "Generating Literal: " << this->value << endl;
-    return context.builder.CreateGlobalString(this->value, "string");
+    /* char *, as the declarations and calls using it expect */
+    return context.builder.CreateGlobalStringPtr(this->value, "string");
 }
 
 Value *NIdentifier::codeGen(CodeGenContext &context)
@@ -279,9 +484,8 @@ Value *NIdentifier::codeGen(CodeGenContext &context)
     //Value *value =
     //    new LoadInst(context.locals()[name], "", false, context.currentBlock());
 
-    Value *value = context.getSymbolValue(this->name);
-    if (!value)
-        cout << "Unknown variable name " + this->name << endl;
+    /* Sema bound the identifier to its declaration */
+    Value *value = this->decl->storage;
 
     if (value->getType()->isPointerTy()) {
         auto arrayPtr = context.builder.CreateLoad(value, "arrayPtr");
@@ -300,20 +504,169 @@ Value *NIdentifier::codeGen(CodeGenContext &context)
     return context.builder.CreateLoad(value, false, "");
 }
 
+/* A printf format split at its conversions, conv is 0 for text */
+struct FormatPiece {
+    char conv;
+    string text;
+};
+
+/* Only %d, %i, %c, %s and %% are recognized, no flags, width or precision */
+static bool parseFormat(const string &format, vector<FormatPiece> &pieces)
+{
+    string text;
+
+    for (size_t i = 0; i < format.size(); i++) {
+        if (format[i] != '%') {
+            text += format[i];
+            continue;
+        }
+        if (++i == format.size())
+            return false;
+        char conv = format[i];
+        if (conv == '%') {
+            text += '%';
+            continue;
+        }
+        if (conv != 'd' && conv != 'i' && conv != 'c' && conv != 's')
+            return false;
+        if (!text.empty())
+            pieces.push_back({ 0, text });
+        text.clear();
+        pieces.push_back({ conv, "" });
+    }
+    if (!text.empty())
+        pieces.push_back({ 0, text });
+    return true;
+}
+
+/*
+ * printf and puts, lowered to the buffered writers of runtime/io.c. A
+ * constant format becomes one writer call per piece, any other format is
+ * formatted into the buffer by c2ir_printf(). Like printf, the value is the
+ * number of bytes written.
+ */
+static Value *emitBufferedOutput(CodeGenContext &context, NMethodCall *call)
+{
+    IRBuilder<> &builder = context.builder;
+    Module *module = context.module;
+    Type *int32Ty = Type::getInt32Ty(context.llvmContext);
+    Type *int8PtrTy = Type::getInt8PtrTy(context.llvmContext);
+    ExpressionList &args = *call->arguments;
+
+    if (call->id->name == "puts") {
+        Value *s = args[0]->codeGen(context);
+        if (!s)
+            return nullptr;
+        context.emitLocation(call);
+        FunctionCallee puts =
+            module->getOrInsertFunction("c2ir_puts", int32Ty, int8PtrTy);
+        return builder.CreateCall(puts, { s });
+    }
+
+    vector<FormatPiece> pieces;
+    auto format = dynamic_cast<NLiteral *>(args[0]);
+    bool constant = format && parseFormat(format->value, pieces) &&
+                    (size_t)count_if(pieces.begin(), pieces.end(),
+                                     [](const FormatPiece &piece) {
+                                         return piece.conv != 0;
+                                     }) == args.size() - 1;
+
+    /* The format string itself is only needed by c2ir_printf() */
+    vector<Value *> values(args.size());
+    for (size_t i = constant ? 1 : 0; i < args.size(); i++) {
+        values[i] = args[i]->codeGen(context);
+        if (!values[i])
+            return nullptr;
+    }
+
+    /* An argument not of the type of its conversion goes to c2ir_printf() */
+    size_t arg = 1;
+    for (auto &piece : pieces) {
+        if (!constant || !piece.conv)
+            continue;
+        Type *type = values[arg++]->getType();
+        if (piece.conv == 's')
+            constant = type == int8PtrTy;
+        else if (piece.conv == 'c')
+            constant = type->isIntegerTy();
+        else
+            constant = type == int32Ty;
+        if (!constant)
+            values[0] = args[0]->codeGen(context);
+    }
+
+    context.emitLocation(call);
+    if (!constant)
+        return builder.CreateCall(
+            module->getOrInsertFunction(
+                "c2ir_printf", FunctionType::get(int32Ty, { int8PtrTy }, true)),
+            values);
+
+    Value *written = ConstantInt::get(int32Ty, 0);
+    arg = 1;
+    for (auto &piece : pieces) {
+        Value *n;
+        switch (piece.conv) {
+        case 0:
+            n = builder.CreateCall(
+                module->getOrInsertFunction("c2ir_write", int32Ty, int8PtrTy,
+                                            int32Ty),
+                { builder.CreateGlobalStringPtr(piece.text, "fmt"),
+                  ConstantInt::get(int32Ty, piece.text.size()) });
+            break;
+        case 's':
+            n = builder.CreateCall(module->getOrInsertFunction(
+                                       "c2ir_write_str", int32Ty, int8PtrTy),
+                                   { values[arg++] });
+            break;
+        case 'c':
+            n = builder.CreateCall(
+                module->getOrInsertFunction("c2ir_write_char", int32Ty,
+                                            int32Ty),
+                { builder.CreateSExtOrTrunc(values[arg++], int32Ty) });
+            break;
+        default:
+            n = builder.CreateCall(module->getOrInsertFunction(
+                                       "c2ir_write_int", int32Ty, int32Ty),
+                                   { values[arg++] });
+            break;
+        }
+        written = builder.CreateAdd(written, n);
+    }
+    return written;
+}
+
 Value *NMethodCall::codeGen(CodeGenContext &context)
 {
     cout << "Generating method call of " << this->id->name << endl;
 
-    Function *calleeF = context.module->getFunction(this->id->name);
-    std::vector<Value *> argsv;
+    if (this->isFolded) {
+        cout << "    folded to " << this->foldedValue << endl;
+        return ConstantInt::get(Type::getInt32Ty(context.llvmContext),
+                                this->foldedValue, true);
+    }
 
-    if (!calleeF)
-        cout << "calleef NULL" << endl;
-    if (calleeF->arg_size() != arguments->size())
-        cout << "Function arguments size not match, calleeF=" +
-                    std::to_string(calleeF->size()) + ", this->arguments=" +
-                    std::to_string(this->arguments->size())
-             << endl;
+    /* The body is named, not called here, only the bounds are values */
+    if (this->parallelBody) {
+        Value *lo = (*arguments)[0]->codeGen(context);
+        Value *hi = (*arguments)[1]->codeGen(context);
+        if (!lo || !hi)
+            return nullptr;
+        cout << "    parallel for of " << this->parallelBody->id->name << endl;
+        context.emitLocation(this);
+        return context.emitParallelFor(lo, hi,
+                                       this->parallelBody->declare(context));
+    }
+
+    /* Output goes through the buffered writers of runtime/io.c */
+    if (context.bufferedIO && this->callee->isExtern &&
+        ((this->id->name == "printf" && !this->arguments->empty()) ||
+         (this->id->name == "puts" && this->arguments->size() == 1)))
+        return emitBufferedOutput(context, this);
+
+    /* Sema bound the call and checked its arguments */
+    Function *calleeF = this->callee->declare(context);
+    std::vector<Value *> argsv;
 
     cout << "    Start of callee arg" << endl;
 
@@ -327,6 +680,8 @@ Value *NMethodCall::codeGen(CodeGenContext &context)
 
     cout << "    End of callee arg" << endl;
 
+    /* Inlining remarks point at the call, not at its statement */
+    context.emitLocation(this);
     return context.builder.CreateCall(calleeF, argsv, "calltmp");
 }
 
@@ -357,13 +712,8 @@ Value *NAssignment::codeGen(CodeGenContext &context)
 {
     cout << "Generating assignment of " << this->lhs->name << " = " << endl;
 
-    if (context.locals().find(lhs->name) == context.locals().end()) {
-        cerr << "undeclared variable " << lhs->name << endl;
-        return NULL;
-    }
-
     Value *exp = this->rhs->codeGen(context);
-    Value *dst = context.getSymbolValue(this->lhs->name);
+    Value *dst = this->lhs->decl->storage;
     //Value *dst = context.locals()[lhs->name];
 
     return context.builder.CreateStore(exp, dst);
@@ -381,6 +731,7 @@ Value *NBlock::codeGen(CodeGenContext &context)
     for (it = statements->begin(); it != statements->end(); it++) {
         std::cout << "      Generating code for " << typeid(**it).name()
                   << endl;
+        context.emitLocation(*it);
         last = (*it)->codeGen(context);
     }
     cout << "    End of block" << endl;
@@ -410,9 +761,7 @@ Value *NVariableDeclaration::codeGen(CodeGenContext &context)
     Value *inst = nullptr;
 
     inst = context.builder.CreateAlloca(type);
-
-    context.setSymbolType(this->id->name, (NIdentifier *)this->type);
-    context.setSymbolValue(this->id->name, inst);
+    this->storage = inst;
 
     if (this->assignmentExpr != nullptr) {
         NAssignment assignment(this->id, this->assignmentExpr);
@@ -421,21 +770,43 @@ Value *NVariableDeclaration::codeGen(CodeGenContext &context)
     return inst;
 }
 
-Value *NFunctionDeclaration::codeGen(CodeGenContext &context)
+Function *NFunctionDeclaration::declare(CodeGenContext &context)
 {
-    cout << "Generating function declaration of " << this->id->name << endl;
-    std::vector<Type *> argTypes;
+    if (this->function)
+        return this->function;
+
+    /*
+     * Several extern prototypes (or the core printf) may share one symbol,
+     * and a definition may follow its prototype.
+     */
+    Function *function = context.module->getFunction(this->id->name);
+    if (!function || (!this->isExtern && !function->isDeclaration())) {
+        std::vector<Type *> argTypes;
 
-    for (auto &arg : *this->arguments)
-        argTypes.push_back(context.TypeOf(*arg->type));
+        for (auto &arg : *this->arguments)
+            argTypes.push_back(context.TypeOf(*arg->type));
 
-    Type *retType = nullptr;
-    retType = context.TypeOf(*this->type);
+        Type *retType = nullptr;
+        retType = context.TypeOf(*this->type);
 
-    FunctionType *functionType = FunctionType::get(retType, argTypes, false);
-    Function *function =
-        Function::Create(functionType, GlobalValue::ExternalLinkage,
-                         this->id->name.c_str(), context.module);
+        FunctionType *functionType =
+            FunctionType::get(retType, argTypes, this->isVarArg);
+        function = Function::Create(functionType, GlobalValue::ExternalLinkage,
+                                    this->id->name.c_str(), context.module);
+    }
+
+    for (auto &attr : this->attributes)
+        context.addFunctionAttribute(function, attr);
+
+    this->function = function;
+    return function;
+}
+
+Value *NFunctionDeclaration::codeGen(CodeGenContext &context)
+{
+    cout << "Generating function declaration of " << this->id->name << endl;
+
+    Function *function = this->declare(context);
 
     if (!this->isExtern) {
         BasicBlock *basicBlock =
@@ -444,6 +815,19 @@ Value *NFunctionDeclaration::codeGen(CodeGenContext &context)
         context.builder.SetInsertPoint(basicBlock);
         context.pushBlock(basicBlock);
 
+        if (context.dbuilder) {
+            DIFile *unit = context.dcu->getFile();
+            DISubprogram *sp = context.dbuilder->createFunction(
+                unit, this->id->name, StringRef(), unit, this->line,
+                context.dbuilder->createSubroutineType(
+                    context.dbuilder->getOrCreateTypeArray(None)),
+                this->line, DINode::FlagPrototyped,
+                DISubprogram::SPFlagDefinition);
+            function->setSubprogram(sp);
+            context.setCurrentScope(sp);
+            context.emitLocation(this);
+        }
+
         cout << "  start of arguments" << endl;
 
         Function::arg_iterator argsValues = function->arg_begin();
@@ -454,9 +838,8 @@ Value *NFunctionDeclaration::codeGen(CodeGenContext &context)
 
             argumentValue = &*argsValues++;
             argumentValue->setName((*it)->id->name.c_str());
-            StoreInst *inst =
-                new StoreInst(argumentValue, context.locals()[(*it)->id->name],
-                              false, basicBlock);
+            StoreInst *inst = new StoreInst(argumentValue, (*it)->storage,
+                                            false, basicBlock);
         }
 
         cout << "  End of arguments" << endl;
@@ -468,6 +851,7 @@ Value *NFunctionDeclaration::codeGen(CodeGenContext &context)
         if (context.getCurrentReturnValue())
             context.builder.CreateRet(context.getCurrentReturnValue());
         context.popBlock();
+        context.builder.SetCurrentDebugLocation(DebugLoc());
     }
 
     return function;
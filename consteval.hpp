@@ -0,0 +1,324 @@
+#ifndef __CONSTEVAL_H__
+#define __CONSTEVAL_H__
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ASTnode.hpp"
+#include "parser.hpp"
+
+using namespace std;
+
+/*
+ * Folds calls of pure functions with constant arguments into their result.
+ *
+ * A function is pure when it takes and returns int, and its body only
+ * declares int locals, assigns, adds and subtracts, and calls pure
+ * functions. Such calls with integer constant arguments are run by a small
+ * AST interpreter, bounded in steps and call depth, and codegen emits the
+ * result instead of the call. The interpreter follows codegen: arithmetic
+ * wraps at 32 bits and the last return statement run gives the result.
+ */
+class ConstEvaluator {
+    struct Slot {
+        bool isInit;
+        int32_t value;
+    };
+    typedef map<string, Slot> Env;
+
+    map<const NFunctionDeclaration *, bool> purity;
+
+    unsigned maxSteps;
+    unsigned maxDepth;
+    unsigned steps = 0;
+    unsigned depth = 0;
+
+    /* Why the last evaluation failed, the innermost cause */
+    string failure;
+    const NFunctionDeclaration *running = nullptr;
+
+public:
+    ConstEvaluator(unsigned maxSteps, unsigned maxDepth)
+        : maxSteps(maxSteps)
+        , maxDepth(maxDepth)
+    {
+    }
+
+    /* Runs after Sema, calls are bound to their declaration */
+    void run(NBlock &program)
+    {
+        for (auto stmt : *program.statements) {
+            auto func = dynamic_cast<NFunctionDeclaration *>(stmt);
+            if (func && !func->isExtern && isPure(func))
+                cout << "Pure function: " << func->id->name << endl;
+        }
+
+        fold(program, 0);
+    }
+
+private:
+    static bool isIntType(const NIdentifier *type)
+    {
+        return type->name == "int" && !type->isPtr;
+    }
+
+    /* ------------------------- Purity ------------------------- */
+
+    bool isPure(const NFunctionDeclaration *func)
+    {
+        auto it = purity.find(func);
+        if (it != purity.end())
+            return it->second;
+
+        /* Recursion is fine here, the depth bound stops it at run time */
+        purity[func] = true;
+
+        bool pure = isIntType(func->type);
+        for (auto arg : *func->arguments)
+            pure = pure && isIntType(arg->type) && !arg->assignmentExpr;
+        pure = pure && isPure(func->block);
+
+        purity[func] = pure;
+        return pure;
+    }
+
+    bool isPure(const NBlock *block)
+    {
+        for (auto stmt : *block->statements)
+            if (!isPure(stmt))
+                return false;
+        return true;
+    }
+
+    bool isPure(const NStatement *stmt)
+    {
+        if (auto s = dynamic_cast<const NExpressionStatement *>(stmt))
+            return isPure(s->expression);
+        if (auto s = dynamic_cast<const NReturnStatement *>(stmt))
+            return isPure(s->expression);
+        if (auto s = dynamic_cast<const NVariableDeclaration *>(stmt))
+            return isIntType(s->type) &&
+                   (!s->assignmentExpr || isPure(s->assignmentExpr));
+        return false;
+    }
+
+    bool isPure(const NExpression *expr)
+    {
+        if (dynamic_cast<const NInteger *>(expr) ||
+            dynamic_cast<const NIdentifier *>(expr))
+            return true;
+        if (auto e = dynamic_cast<const NBinaryOperator *>(expr))
+            return (e->op == T_ADD || e->op == T_MINUS) && isPure(e->rhs);
+        if (auto e = dynamic_cast<const NAssignment *>(expr))
+            return isPure(e->rhs);
+        if (auto e = dynamic_cast<const NMethodCall *>(expr)) {
+            if (e->isFolded)
+                return true;
+            NFunctionDeclaration *callee = e->callee;
+            if (!callee || callee->isExtern ||
+                callee->arguments->size() != e->arguments->size() ||
+                !isPure(callee))
+                return false;
+            for (auto arg : *e->arguments)
+                if (!isPure(arg))
+                    return false;
+            return true;
+        }
+        return false;
+    }
+
+    /* ------------------------- Interpreter ------------------------- */
+
+    bool fail(const string &why)
+    {
+        if (failure.empty())
+            failure = why;
+        return false;
+    }
+
+    bool call(NFunctionDeclaration *func, const vector<int32_t> &args,
+              int32_t &result)
+    {
+        if (depth >= maxDepth)
+            return fail("call depth " + to_string(maxDepth) + " reached in " +
+                        func->id->name + "() (-const-eval-depth)");
+        depth++;
+        const NFunctionDeclaration *caller = running;
+        running = func;
+
+        Env env;
+        for (size_t i = 0; i < args.size(); i++)
+            env[(*func->arguments)[i]->id->name] = { true, args[i] };
+
+        bool hasReturn = false;
+        bool ok = true;
+        for (auto stmt : *func->block->statements) {
+            ok = exec(stmt, env, hasReturn, result);
+            if (!ok)
+                break;
+        }
+
+        depth--;
+        running = caller;
+        if (ok && !hasReturn)
+            return fail(func->id->name + "() ran no return statement");
+        return ok;
+    }
+
+    bool exec(NStatement *stmt, Env &env, bool &hasReturn, int32_t &result)
+    {
+        int32_t value;
+
+        if (auto s = dynamic_cast<NExpressionStatement *>(stmt))
+            return eval(s->expression, env, value);
+        if (auto s = dynamic_cast<NReturnStatement *>(stmt)) {
+            if (!eval(s->expression, env, result))
+                return false;
+            hasReturn = true;
+            return true;
+        }
+        if (auto s = dynamic_cast<NVariableDeclaration *>(stmt)) {
+            env[s->id->name] = { false, 0 };
+            if (!s->assignmentExpr)
+                return true;
+            if (!eval(s->assignmentExpr, env, value))
+                return false;
+            env[s->id->name] = { true, value };
+            return true;
+        }
+        return fail("unsupported statement");
+    }
+
+    bool eval(NExpression *expr, Env &env, int32_t &value)
+    {
+        if (++steps > maxSteps)
+            return fail("more than " + to_string(maxSteps) +
+                        " steps (-const-eval-steps)");
+
+        if (auto e = dynamic_cast<NInteger *>(expr)) {
+            value = (int32_t)e->value;
+            return true;
+        }
+        if (auto e = dynamic_cast<NIdentifier *>(expr)) {
+            auto it = env.find(e->name);
+            if (it == env.end() || !it->second.isInit)
+                return fail("read of uninitialized " + e->name +
+                            (running ? " in " + running->id->name + "()"
+                                     : string()));
+            value = it->second.value;
+            return true;
+        }
+        if (auto e = dynamic_cast<NBinaryOperator *>(expr)) {
+            int32_t lhs, rhs;
+            if (!eval(e->lhs, env, lhs) || !eval(e->rhs, env, rhs))
+                return false;
+            /* Wrap around as the i32 add/sub codegen emits */
+            if (e->op == T_ADD)
+                value = (int32_t)((uint32_t)lhs + (uint32_t)rhs);
+            else
+                value = (int32_t)((uint32_t)lhs - (uint32_t)rhs);
+            return true;
+        }
+        if (auto e = dynamic_cast<NAssignment *>(expr)) {
+            auto it = env.find(e->lhs->name);
+            if (it == env.end())
+                return fail("assignment of undeclared " + e->lhs->name);
+            if (!eval(e->rhs, env, value))
+                return false;
+            it->second = { true, value };
+            return true;
+        }
+        if (auto e = dynamic_cast<NMethodCall *>(expr)) {
+            if (e->isFolded) {
+                value = (int32_t)e->foldedValue;
+                return true;
+            }
+            vector<int32_t> args;
+            for (auto arg : *e->arguments) {
+                int32_t argValue;
+                if (!eval(arg, env, argValue))
+                    return false;
+                args.push_back(argValue);
+            }
+            return call(e->callee, args, value);
+        }
+        return fail("unsupported expression");
+    }
+
+    /* ------------------------- Folding ------------------------- */
+
+    static bool isConstant(const NExpression *expr)
+    {
+        if (dynamic_cast<const NInteger *>(expr))
+            return true;
+        auto call = dynamic_cast<const NMethodCall *>(expr);
+        return call && call->isFolded;
+    }
+
+    void tryFold(NMethodCall *callExpr, int line)
+    {
+        if (!isPure(callExpr))
+            return;
+        for (auto arg : *callExpr->arguments)
+            if (!isConstant(arg))
+                return;
+
+        Env env;
+        int32_t value;
+        steps = 0;
+        failure.clear();
+        if (!eval(callExpr, env, value)) {
+            cout << "Not folded " << callExpr->id->name << "() at line "
+                 << line << ": " << failure << endl;
+            return;
+        }
+
+        callExpr->isFolded = true;
+        callExpr->foldedValue = value;
+
+        cout << "Folded " << callExpr->id->name << "(";
+        for (size_t i = 0; i < callExpr->arguments->size(); i++) {
+            int32_t arg;
+            eval((*callExpr->arguments)[i], env, arg);
+            cout << (i ? ", " : "") << arg;
+        }
+        cout << ") = " << value << " at line " << line << endl;
+    }
+
+    /* Fold bottom-up, so that folded arguments make their callers constant */
+    void fold(NExpression *expr, int line)
+    {
+        if (auto e = dynamic_cast<NBinaryOperator *>(expr)) {
+            fold(e->rhs, line);
+        } else if (auto e = dynamic_cast<NAssignment *>(expr)) {
+            fold(e->rhs, line);
+        } else if (auto e = dynamic_cast<NMethodCall *>(expr)) {
+            for (auto arg : *e->arguments)
+                fold(arg, line);
+            tryFold(e, line);
+        }
+    }
+
+    void fold(NBlock &block, int line)
+    {
+        for (auto stmt : *block.statements) {
+            int stmtLine = stmt->line ? stmt->line : line;
+            if (auto s = dynamic_cast<NExpressionStatement *>(stmt))
+                fold(s->expression, stmtLine);
+            else if (auto s = dynamic_cast<NReturnStatement *>(stmt))
+                fold(s->expression, stmtLine);
+            else if (auto s = dynamic_cast<NVariableDeclaration *>(stmt)) {
+                if (s->assignmentExpr)
+                    fold(s->assignmentExpr, stmtLine);
+            } else if (auto s = dynamic_cast<NFunctionDeclaration *>(stmt)) {
+                if (s->block)
+                    fold(*s->block, stmtLine);
+            }
+        }
+    }
+};
+
+#endif /* __CONSTEVAL_H__ */
@@ -7,9 +7,6 @@
 
 using namespace std;
 
-extern int yyparse();
-extern NBlock *programBlock;
-
 llvm::Function *createPrintfFunction(CodeGenContext &context)
 {
     std::vector<llvm::Type *> printf_arg_types;
@@ -26,51 +23,41 @@ llvm::Function *createPrintfFunction(CodeGenContext &context)
     return func;
 }
 
+/*
+ * int echo(int): print the value and a newline, with the buffered writers
+ * of runtime/io.c, or printf("%d\n") with -buffered-io=false.
+ */
 void createEchoFunction(CodeGenContext &context, llvm::Function *printfFn)
 {
-    std::vector<llvm::Type *> echo_arg_types;
-    echo_arg_types.push_back(llvm::Type::getInt64Ty(context.llvmContext));
-
-    llvm::FunctionType *echo_type = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(context.llvmContext), echo_arg_types, false);
+    llvm::Type *int32Ty = llvm::Type::getInt32Ty(context.llvmContext);
+    llvm::FunctionType *echo_type =
+        llvm::FunctionType::get(int32Ty, { int32Ty }, false);
 
     llvm::Function *func =
         llvm::Function::Create(echo_type, llvm::Function::InternalLinkage,
                                llvm::Twine("echo"), context.module);
     llvm::BasicBlock *bblock =
         llvm::BasicBlock::Create(context.llvmContext, "entry", func, 0);
-    context.pushBlock(bblock);
-
-    const char *constValue = "%d\n";
-    llvm::Constant *format_const =
-        llvm::ConstantDataArray::getString(context.llvmContext, constValue);
-    llvm::GlobalVariable *var = new llvm::GlobalVariable(
-        *context.module,
-        llvm::ArrayType::get(llvm::IntegerType::get(context.llvmContext, 8),
-                             strlen(constValue) + 1),
-        true, llvm::GlobalValue::PrivateLinkage, format_const, ".str");
-    llvm::Constant *zero = llvm::Constant::getNullValue(
-        llvm::IntegerType::getInt32Ty(context.llvmContext));
-
-    std::vector<llvm::Constant *> indices;
-    indices.push_back(zero);
-    indices.push_back(zero);
-    llvm::Constant *var_ref = llvm::ConstantExpr::getGetElementPtr(
-        llvm::ArrayType::get(llvm::IntegerType::get(context.llvmContext, 8),
-                             strlen(constValue) + 1),
-        var, indices);
-
-    std::vector<Value *> args;
-    args.push_back(var_ref);
+    IRBuilder<> builder(bblock);
 
-    Function::arg_iterator argsValues = func->arg_begin();
-    Value *toPrint = &*argsValues++;
+    Value *toPrint = &*func->arg_begin();
     toPrint->setName("toPrint");
-    args.push_back(toPrint);
 
-    CallInst *call = CallInst::Create(printfFn, makeArrayRef(args), "", bblock);
-    ReturnInst::Create(context.llvmContext, bblock);
-    context.popBlock();
+    Value *written;
+    if (context.bufferedIO) {
+        FunctionCallee writeInt = context.module->getOrInsertFunction(
+            "c2ir_write_int", int32Ty, int32Ty);
+        FunctionCallee writeChar = context.module->getOrInsertFunction(
+            "c2ir_write_char", int32Ty, int32Ty);
+        Value *digits = builder.CreateCall(writeInt, { toPrint });
+        Value *newline =
+            builder.CreateCall(writeChar, { ConstantInt::get(int32Ty, '\n') });
+        written = builder.CreateAdd(digits, newline);
+    } else {
+        Value *format = builder.CreateGlobalStringPtr("%d\n", ".str");
+        written = builder.CreateCall(printfFn, { format, toPrint });
+    }
+    builder.CreateRet(written);
 }
 
 void createCoreFunctions(CodeGenContext &context)
@@ -0,0 +1,39 @@
+#ifndef __LEXER_H__
+#define __LEXER_H__
+
+#include <cstddef>
+#include <string>
+
+#include "ASTnode.hpp"
+#include "parser.hpp"
+
+/*
+ * The parser is pure and the lexers are reentrant, so several inputs may
+ * be parsed at once, each with its own ParseState.
+ */
+struct ParseState {
+    void *scanner = nullptr;
+    std::string filename;
+    NBlock *program = nullptr;
+    std::string error; /* first syntax error, empty on success */
+    size_t tokens = 0;
+    bool terminated = false; /* the lexer stopped at an unknown token */
+};
+
+/*
+ * Interface of both lex.l and simdlex.cpp. A scanner reads len bytes of
+ * buf, the first of which is at source line line and column column.
+ */
+void *lexerCreate(const char *buf, size_t len, int line, int column);
+void lexerDestroy(void *scanner);
+int lexerLex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+/*
+ * The scanner stopped early at an unknown token. The lexers don't report
+ * it themselves, parseProgram() does, in source order.
+ */
+bool lexerTerminated(void *scanner);
+
+/* Print a "LEX_<token>" line per token, on unless benchmarking the lexer */
+extern bool lexerTrace;
+
+#endif /* __LEXER_H__ */
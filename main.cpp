@@ -1,34 +1,332 @@
 #include <iostream>
+#include <cstdio>
+#include <chrono>
+
+#include <llvm/Support/CommandLine.h>
 
 #include "codegen.hpp"
 #include "ASTnode.hpp"
 
 #include "objgen.hpp"
 #include "corefn.hpp"
+#include "profile.hpp"
+#include "parse.hpp"
+#include "sema.hpp"
+#include "consteval.hpp"
 
 using namespace std;
 
-extern int yyparse();
-extern NBlock *programBlock;
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input file>"),
+                                          cl::init("-"));
+
+static cl::opt<bool> RunJIT("jit",
+                            cl::desc("Run the program with the JIT instead "
+                                     "of writing an object file"));
+
+static cl::opt<bool> PerfJIT("perf",
+                             cl::desc("Write perf jitdump and "
+                                      "/tmp/perf-PID.map entries for the "
+                                      "JIT-ed code (implies -g)"));
+
+static cl::opt<bool> DebugInfo("g", cl::desc("Emit source line information"));
+
+static cl::list<std::string>
+    Targets("target",
+            cl::desc("Emit text.<cpu>.o for triple:cpu[:features], may be "
+                     "repeated, the triple may be left empty"),
+            cl::value_desc("triple:cpu[:features]"));
+
+static cl::opt<bool> Dispatch("dispatch",
+                              cl::desc("With -target, also write "
+                                       "text.dispatch.c which picks the best "
+                                       "variant at load time"));
+
+static cl::opt<unsigned> OptLevel("O", cl::Prefix, cl::init(0),
+                                  cl::desc("Optimization level, -O0 to -O3"),
+                                  cl::value_desc("level"));
+
+static cl::opt<std::string>
+    PassPipeline("passes",
+                 cl::desc("Textual new PassManager pipeline to run instead "
+                          "of the -O pipeline, e.g. -passes='default<O2>'"),
+                 cl::value_desc("pipeline"));
+
+static cl::list<std::string>
+    PassPlugins("load-pass-plugin",
+                cl::desc("Load a pass plugin, its passes may be used in "
+                         "-passes"),
+                cl::value_desc("path"));
+
+static cl::opt<bool> FunctionSections("ffunction-sections",
+                                      cl::desc("Emit each function in its "
+                                               "own section"));
+
+static cl::opt<bool> DataSections("fdata-sections",
+                                  cl::desc("Emit each global in its own "
+                                           "section"));
+
+static cl::opt<std::string> SaveRemarks(
+    "fsave-optimization-record", cl::ValueOptional,
+    cl::desc("Write the optimization remarks to text.opt.<format>, yaml "
+             "(default) or bitstream"),
+    cl::value_desc("format"));
+
+static cl::opt<std::string>
+    RemarksFilename("foptimization-record-file",
+                    cl::desc("With -fsave-optimization-record, write the "
+                             "remarks here instead"),
+                    cl::value_desc("file"));
+
+static cl::opt<std::string>
+    RemarksPasses("foptimization-record-passes",
+                  cl::desc("Only keep the remarks of the passes matching "
+                           "this regex"),
+                  cl::value_desc("regex"));
+
+static cl::opt<std::string>
+    ProfileFilename("profile",
+                    cl::desc("perf script output or LLVM text sample "
+                             "profile, functions are laid out hot-first"),
+                    cl::value_desc("file"));
+
+static cl::opt<std::string>
+    SymbolOrderingFilename("symbol-ordering-file",
+                           cl::desc("With -profile, write the hot functions "
+                                    "for the linker's --symbol-ordering-file, "
+                                    "without an input file only that"),
+                           cl::value_desc("file"));
+
+static cl::opt<unsigned>
+    ParseThreads("parse-threads", cl::init(1),
+                 cl::desc("Parse the top level declarations on this many "
+                          "threads, 0 for one per core"),
+                 cl::value_desc("N"));
+
+static cl::opt<bool>
+    ConstEval("const-eval", cl::init(true),
+              cl::desc("Evaluate calls of pure functions with constant "
+                       "arguments at compile time (default on)"));
+
+static cl::opt<unsigned>
+    ConstEvalSteps("const-eval-steps", cl::init(100000),
+                   cl::desc("Expressions evaluated per folded call at most"));
+
+static cl::opt<unsigned>
+    ConstEvalDepth("const-eval-depth", cl::init(64),
+                   cl::desc("Call depth of a folded call at most"));
+
+static cl::opt<bool>
+    BufferedIO("buffered-io", cl::init(true),
+               cl::desc("Lower echo, printf and puts to the buffered "
+                        "writers of libc2ir_rt.a (default on)"));
+
+static cl::opt<bool> LexOnly("lex-only",
+                             cl::desc("Only run the lexer and report its "
+                                      "throughput"));
+
+static cl::opt<bool>
+    LexTrace("lex-trace",
+             cl::desc("With -lex-only, print every token with its location "
+                      "and text instead of the throughput"));
+
+bool lexerTrace = true;
+
+/* The tokens carrying their text */
+static bool hasString(int token)
+{
+    switch (token) {
+    case T_IDENTIFIER:
+    case T_INT:
+    case T_CHAR:
+    case T_INTEGER:
+    case T_LITERAL:
+    case T_HEADER:
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Drain the lexer. The throughput goes to stderr, timed without the token
+ * trace, or with -lex-trace the trace goes to stdout, for diffing the
+ * lexers (make lex-diff).
+ */
+static int lexOnly(const string &input)
+{
+    YYSTYPE lval;
+    YYLTYPE lloc;
+    size_t tokens = 0;
+    int token;
+
+    lexerTrace = LexTrace;
+    auto start = chrono::steady_clock::now();
+    void *scanner = lexerCreate(input.data(), input.size(), 1, 1);
+    while ((token = lexerLex(&lval, &lloc, scanner))) {
+        tokens++;
+        if (LexTrace)
+            cout << "        at " << lloc.first_line << ":"
+                 << lloc.first_column << "-" << lloc.last_column;
+        if (hasString(token)) {
+            if (LexTrace)
+                cout << " '" << *lval.string << "'";
+            delete lval.string;
+        }
+        if (LexTrace)
+            cout << "\n";
+    }
+    if (lexerTerminated(scanner))
+        cout << "Unknown token" << endl;
+    lexerDestroy(scanner);
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+
+    if (!LexTrace)
+        errs() << tokens << " tokens in "
+               << format("%.3fs, %.1f MB/s\n", secs.count(),
+                         input.size() / secs.count() / 1e6);
+    return 0;
+}
+
+/*
+ * -profile and -symbol-ordering-file without an input file: order every
+ * sampled symbol, there is no module to keep only its functions from.
+ */
+static int symbolOrderingOnly()
+{
+    FunctionWeights weights;
+    std::string error;
+    if (!readProfile(ProfileFilename, weights, error)) {
+        errs() << error << "\n";
+        return 1;
+    }
+    if (!writeSymbolOrderingFile(hotSymbols(weights), SymbolOrderingFilename))
+        return 1;
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
-    yyparse();
+    cl::ParseCommandLineOptions(argc, argv, "c2ir compiler\n");
+
+    if (!SymbolOrderingFilename.empty()) {
+        if (ProfileFilename.empty()) {
+            errs() << "-symbol-ordering-file needs -profile\n";
+            return 1;
+        }
+        if (!InputFilename.getNumOccurrences())
+            return symbolOrderingOnly();
+    }
+
+    std::vector<TargetSpec> specs;
+    for (auto &target : Targets) {
+        TargetSpec spec;
+        if (!parseTargetSpec(target, spec)) {
+            errs() << "invalid -target " << target
+                   << ", expected triple:cpu[:features]\n";
+            return 1;
+        }
+        /* Before parsing, a foreign triple needs make TARGETS=all */
+        std::string error;
+        if (!spec.triple.empty() && !ensureTarget(spec.triple, error)) {
+            errs() << "invalid -target " << target << ": " << error << "\n";
+            return 1;
+        }
+        specs.push_back(spec);
+    }
+
+    FILE *in = stdin;
+    if (InputFilename != "-") {
+        in = fopen(InputFilename.c_str(), "r");
+        if (!in) {
+            errs() << "can't open " << InputFilename << "\n";
+            return 1;
+        }
+    }
+
+    string input;
+    if (!readInput(in, input)) {
+        errs() << "can't read " << InputFilename << "\n";
+        return 1;
+    }
+
+    if (LexOnly)
+        return lexOnly(input);
+
+    unsigned threads = ParseThreads;
+    if (threads == 0)
+        threads = thread::hardware_concurrency();
+
+    string filename =
+        InputFilename == "-" ? "<stdin>" : InputFilename.getValue();
+    NBlock *programBlock = parseProgram(input, filename, threads);
+    if (!programBlock)
+        return 1;
     cout << programBlock << endl;
 
     cout << "---------------------" << endl;
 
-    InitializeNativeTarget();
-    InitializeNativeTargetAsmPrinter();
-    InitializeNativeTargetAsmParser();
+    Sema sema(filename);
+    if (!sema.check(*programBlock))
+        return 1;
+    sema.printCallGraph();
+
+    cout << "---------------------" << endl;
+
+    if (ConstEval) {
+        ConstEvaluator evaluator(ConstEvalSteps, ConstEvalDepth);
+        evaluator.run(*programBlock);
 
+        cout << "---------------------" << endl;
+    }
+
+    /* Remarks are located by the debug locations, tracked without -g */
+    bool saveRemarks = SaveRemarks.getNumOccurrences() > 0;
     CodeGenContext context;
+    if (DebugInfo || PerfJIT || saveRemarks)
+        context.initDebugInfo(filename, DebugInfo || PerfJIT);
+    context.perfJITEvents = PerfJIT;
+    context.bufferedIO = BufferedIO;
+    context.functionOrder = sema.postOrder();
     createCoreFunctions(context);
+
+    if (RunJIT)
+        return context.generateAndRunCode(*programBlock) ? 0 : 1;
+
     context.generateCode(*programBlock);
 
     cout << "---------------------" << endl;
 
-    ObjGen(context, "text.o");
+    if (!ProfileFilename.empty()) {
+        FunctionWeights weights;
+        std::string error;
+        if (!readProfile(ProfileFilename, weights, error)) {
+            errs() << error << "\n";
+            return 1;
+        }
+        orderFunctions(*context.module, weights);
+        if (!SymbolOrderingFilename.empty() &&
+            !writeSymbolOrderingFile(hotSymbols(*context.module, weights),
+                                     SymbolOrderingFilename))
+            return 1;
+    }
 
-    return 0;
+    OptOptions opt;
+    opt.level = OptLevel;
+    opt.passes = PassPipeline;
+    opt.plugins = PassPlugins;
+    opt.functionSections = FunctionSections;
+    opt.dataSections = DataSections;
+    opt.saveRemarks = saveRemarks;
+    if (!SaveRemarks.empty())
+        opt.remarksFormat = SaveRemarks;
+    opt.remarksFile = RemarksFilename;
+    opt.remarksPasses = RemarksPasses;
+
+    bool written;
+    if (!specs.empty())
+        written = ObjGenMultiTarget(context, specs, "text", Dispatch, opt);
+    else
+        written = ObjGen(context, "text.o", opt);
+
+    return written ? 0 : 1;
 }
@@ -5,70 +5,554 @@
 #include <llvm/Support/Host.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/TargetRegistry.h>
-#include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/MC/MCSubtargetInfo.h>
 #include <llvm/ADT/Optional.h>
+#include <llvm/ADT/ScopeExit.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/PassPlugin.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/IR/RemarkStreamer.h>
+#include <llvm/Support/ToolOutputFile.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "codegen.hpp"
+#include "targets.hpp"
 
 using namespace llvm;
 
-void ObjGen(CodeGenContext &context, const string &filename)
+struct TargetSpec {
+    std::string triple; /* empty for the default target triple */
+    std::string cpu = "generic";
+    std::string features;
+};
+
+/* Parse "triple:cpu[:features]", the triple may be left empty */
+static inline bool parseTargetSpec(const std::string &str, TargetSpec &spec)
 {
-    // Initialize the target registry etc.
-    InitializeAllTargetInfos();
-    InitializeAllTargets();
-    InitializeAllTargetMCs();
-    InitializeAllAsmParsers();
-    InitializeAllAsmPrinters();
+    SmallVector<StringRef, 3> fields;
+    StringRef(str).split(fields, ':', 2);
+    if (fields.size() < 2 || fields[1].empty())
+        return false;
+
+    spec.triple = fields[0].str();
+    spec.cpu = fields[1].str();
+    spec.features = fields.size() > 2 ? fields[2].str() : "";
+    return true;
+}
 
-    auto targetTriple = sys::getDefaultTargetTriple();
-    context.module->setTargetTriple(targetTriple);
+struct OptOptions {
+    unsigned level = 0;               /* -O0 .. -O3 */
+    std::string passes;               /* -passes=, replaces the -O pipeline */
+    std::vector<std::string> plugins; /* -load-pass-plugin= */
+    bool functionSections = false;    /* -ffunction-sections */
+    bool dataSections = false;        /* -fdata-sections */
 
-    std::string error;
-    auto Target = TargetRegistry::lookupTarget(targetTriple, error);
+    /* -fsave-optimization-record[=format] */
+    bool saveRemarks = false;
+    std::string remarksFormat = "yaml"; /* yaml or bitstream */
+    std::string remarksFile;   /* empty for <object stem>.opt.<format> */
+    std::string remarksPasses; /* regex of the passes kept, empty for all */
+};
+
+/* text.o -> text.opt.yaml, as clang names the record of its object */
+static inline std::string remarksFilename(const std::string &object,
+                                          const OptOptions &opt)
+{
+    if (!opt.remarksFile.empty())
+        return opt.remarksFile;
+    StringRef stem = StringRef(object);
+    if (stem.endswith(".o"))
+        stem = stem.drop_back(2);
+    return (stem + ".opt." + opt.remarksFormat).str();
+}
+
+static inline CodeGenOpt::Level codeGenOptLevel(const OptOptions &opt)
+{
+    switch (opt.level) {
+    case 0:
+        return CodeGenOpt::None;
+    case 1:
+        return CodeGenOpt::Less;
+    case 2:
+        return CodeGenOpt::Default;
+    default:
+        return CodeGenOpt::Aggressive;
+    }
+}
+
+/*
+ * Run the new PassManager over module, either the default pipeline of the
+ * -O level or the textual -passes= pipeline. Plugins register their passes
+ * into the PassBuilder, so they may be named in -passes=. -O0 only inlines
+ * the always_inline functions, as clang does.
+ */
+static bool optimizeModule(Module &module, TargetMachine *TM,
+                           const OptOptions &opt, std::string &error)
+{
+    bool alwaysInline = any_of(module, [](const Function &F) {
+        return F.hasFnAttribute(Attribute::AlwaysInline);
+    });
+    if (opt.passes.empty() && opt.level == 0 && !alwaysInline)
+        return true;
+
+    PassBuilder PB(TM);
+    for (auto &path : opt.plugins) {
+        auto plugin = PassPlugin::Load(path);
+        if (!plugin) {
+            error = toString(plugin.takeError());
+            return false;
+        }
+        plugin->registerPassBuilderCallbacks(PB);
+    }
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
 
-    if (!Target) {
-        errs() << error;
-        return;
+    FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (!opt.passes.empty()) {
+        if (auto err = PB.parsePassPipeline(MPM, opt.passes)) {
+            error = "invalid -passes: " + toString(std::move(err));
+            return false;
+        }
+    } else if (opt.level == 0) {
+        MPM.addPass(AlwaysInlinerPass());
+    } else {
+        static const PassBuilder::OptimizationLevel levels[] = {
+            PassBuilder::OptimizationLevel::O1,
+            PassBuilder::OptimizationLevel::O2,
+            PassBuilder::OptimizationLevel::O3,
+        };
+        MPM = PB.buildPerModuleDefaultPipeline(
+            levels[std::min(opt.level, 3u) - 1]);
     }
 
-    auto CPU = "generic";
-    auto features = "";
+    MPM.run(module, MAM);
+    return true;
+}
+
+/* Run the codegen pipeline of one target over module and write filename */
+static bool emitObject(Module &module, const TargetSpec &spec,
+                       const OptOptions &optOptions, const string &filename,
+                       std::string &error)
+{
+    auto targetTriple =
+        spec.triple.empty() ? sys::getDefaultTargetTriple() : spec.triple;
+    module.setTargetTriple(targetTriple);
+
+    if (!ensureTarget(targetTriple, error))
+        return false;
+    auto Target = TargetRegistry::lookupTarget(targetTriple, error);
+
+    if (!Target)
+        return false;
 
     TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    auto theTargetMachine =
-        Target->createTargetMachine(targetTriple, CPU, features, opt, RM);
+    opt.FunctionSections = optOptions.functionSections;
+    opt.DataSections = optOptions.dataSections;
+    /* Linkable into the PIE executables compilers build by default */
+    auto RM = Optional<Reloc::Model>(Reloc::PIC_);
+    std::unique_ptr<TargetMachine> theTargetMachine(Target->createTargetMachine(
+        targetTriple, spec.cpu, spec.features, opt, RM, None,
+        codeGenOptLevel(optOptions)));
+    /* LLVM only warns, then may abort in codegen */
+    if (!theTargetMachine->getMCSubtargetInfo()->isCPUStringValid(spec.cpu)) {
+        error = "unknown cpu " + spec.cpu + " for " + targetTriple;
+        return false;
+    }
+
+    module.setDataLayout(theTargetMachine->createDataLayout());
+    module.setTargetTriple(targetTriple);
+
+    /*
+     * Stream the passed, missed and analysis remarks of both the optimization
+     * pipeline and codegen, located by the debug locations of the IR.
+     */
+    std::unique_ptr<ToolOutputFile> remarks;
+    /* The context outlives the file, detach the streamer from it first */
+    auto detachRemarks = make_scope_exit(
+        [&] { module.getContext().setRemarkStreamer(nullptr); });
+    if (optOptions.saveRemarks) {
+        auto file = setupOptimizationRemarks(
+            module.getContext(), remarksFilename(filename, optOptions),
+            optOptions.remarksPasses, optOptions.remarksFormat, false);
+        if (!file) {
+            error = toString(file.takeError());
+            return false;
+        }
+        remarks = std::move(*file);
+    }
+
+    /* Report broken IR here rather than as a crash inside some pass */
+    std::string broken;
+    raw_string_ostream brokenOS(broken);
+    if (verifyModule(module, &brokenOS)) {
+        error = "invalid IR generated:\n" + brokenOS.str();
+        return false;
+    }
 
-    context.module->setDataLayout(theTargetMachine->createDataLayout());
-    context.module->setTargetTriple(targetTriple);
+    if (!optimizeModule(module, theTargetMachine.get(), optOptions, error))
+        return false;
 
     std::error_code EC;
     raw_fd_ostream dest(filename.c_str(), EC, sys::fs::F_None);
-    //    raw_fd_ostream dest(filename.c_str(), EC, sys::fs::F_None);
-    //    formatted_raw_ostream formattedRawOstream(dest);
+    if (EC) {
+        error = "can't open " + filename + ": " + EC.message();
+        return false;
+    }
 
     legacy::PassManager pass;
     //auto fileType = TargetMachine::CGFT_ObjectFile;
 
     if (theTargetMachine->addPassesToEmitFile(pass, dest, nullptr,
                                               llvm::CGFT_ObjectFile)) {
-        errs() << "theTargetMachine can't emit a file of this type";
-        return;
+        error = "theTargetMachine can't emit a file of this type";
+        return false;
     }
 
-    pass.run(*context.module);
+    pass.run(module);
     dest.flush();
 
+    if (remarks)
+        remarks->keep();
+
+    return true;
+}
+
+bool ObjGen(CodeGenContext &context, const string &filename,
+            const OptOptions &opt = OptOptions())
+{
+    std::string error;
+    if (!emitObject(*context.module, TargetSpec(), opt, filename, error)) {
+        errs() << error << "\n";
+        return false;
+    }
+
     outs() << "Object code wrote to " << filename.c_str() << "\n";
+    if (opt.saveRemarks)
+        outs() << "Optimization remarks wrote to "
+               << remarksFilename(filename, opt) << "\n";
+
+    return true;
+}
+
+/* ------------------------- Multi-target ------------------------- */
+
+/* A C identifier fragment naming the variant, "x86-64" becomes "x86_64" */
+static inline std::string variantSuffix(const TargetSpec &spec)
+{
+    std::string suffix = spec.cpu;
+    for (auto &c : suffix)
+        if (!isalnum(c))
+            c = '_';
+    return suffix;
+}
+
+/*
+ * Give every function the variant defines a per-variant name, so that all
+ * variants can be linked into one binary next to the dispatch stub.
+ */
+static void renameForVariant(Module &module, const std::string &suffix)
+{
+    for (auto &F : module) {
+        if (F.isDeclaration() || !F.hasExternalLinkage())
+            continue;
+        F.setName(F.getName() + "__" + suffix);
+    }
+}
+
+/* The CPU names and features GCC and clang know in __builtin_cpu_is/supports */
+static const char *const dispatchCpus[] = {
+    "intel", "atom", "bonnell", "silvermont", "goldmont", "goldmont-plus",
+    "tremont", "knl", "knm", "core2", "corei7", "nehalem", "westmere",
+    "sandybridge", "ivybridge", "haswell", "broadwell", "skylake",
+    "skylake-avx512", "cannonlake", "icelake-client", "icelake-server",
+    "cascadelake", "amd", "amdfam10h", "barcelona", "shanghai", "istanbul",
+    "btver1", "btver2", "amdfam15h", "bdver1", "bdver2", "bdver3", "bdver4",
+    "amdfam17h", "znver1", "znver2",
+};
+
+static const char *const dispatchFeatures[] = {
+    "cmov", "mmx", "popcnt", "sse", "sse2", "sse3", "ssse3", "sse4.1",
+    "sse4.2", "avx", "avx2", "sse4a", "fma4", "xop", "fma", "avx512f",
+    "bmi", "bmi2", "aes", "pclmul", "avx512vl", "avx512bw", "avx512dq",
+    "avx512cd", "avx512er", "avx512pf", "avx512vbmi", "avx512ifma",
+    "avx5124vnniw", "avx5124fmaps", "avx512vpopcntdq", "avx512vbmi2",
+    "gfni", "vpclmulqdq", "avx512vnni", "avx512bitalg",
+};
+
+template <size_t N>
+static inline bool isOneOf(StringRef name, const char *const (&names)[N])
+{
+    return std::find(std::begin(names), std::end(names), name) !=
+           std::end(names);
+}
+
+/*
+ * The C condition under which the variant of spec runs: its + features,
+ * else its CPU, else none for a variant which always runs.
+ */
+static bool dispatchCondition(const TargetSpec &spec, std::string &cond,
+                              std::string &error)
+{
+    cond.clear();
+    SmallVector<StringRef, 8> features;
+    StringRef(spec.features).split(features, ',', -1, false);
+    for (auto feature : features) {
+        if (!feature.startswith("+"))
+            continue;
+        feature = feature.drop_front();
+        if (!isOneOf(feature, dispatchFeatures)) {
+            error = "-dispatch can't test feature " + feature.str() +
+                    " with __builtin_cpu_supports";
+            return false;
+        }
+        if (!cond.empty())
+            cond += " && ";
+        cond += "__builtin_cpu_supports(\"" + feature.str() + "\")";
+    }
+    if (cond.empty() && spec.cpu != "generic" && spec.cpu != "x86-64") {
+        if (!isOneOf(spec.cpu, dispatchCpus)) {
+            error = "-dispatch can't test cpu " + spec.cpu +
+                    " with __builtin_cpu_is, give its features instead "
+                    "(-target=:" + spec.cpu + ":+avx2,+fma)";
+            return false;
+        }
+        cond = "__builtin_cpu_is(\"" + spec.cpu + "\")";
+    }
+    return true;
+}
+
+/* The C spelling of a c2ir type in the stub, empty for other types */
+static std::string cTypeName(Type *type)
+{
+    if (type->isVoidTy())
+        return "void";
+    if (type->isIntegerTy(8))
+        return "char";
+    if (type->isIntegerTy(32))
+        return "int";
+    if (type->isIntegerTy(64))
+        return "long long";
+    if (type->isPointerTy())
+        return type->getPointerElementType()->isIntegerTy(8) ? "char *"
+                                                             : "void *";
+    return "";
+}
+
+/* "ret name(params)", with the parameters named a0, a1... when named */
+static bool cPrototype(const Function &F, const std::string &name,
+                       bool named, std::string &proto, std::string &error)
+{
+    FunctionType *type = F.getFunctionType();
+    std::string ret = cTypeName(type->getReturnType());
+    if (ret.empty()) {
+        error = "-dispatch can't spell the return type of " + name + " in C";
+        return false;
+    }
+
+    std::string params;
+    for (unsigned i = 0; i < type->getNumParams(); i++) {
+        std::string param = cTypeName(type->getParamType(i));
+        if (param.empty() || param == "void") {
+            error = "-dispatch can't spell the parameters of " + name + " in C";
+            return false;
+        }
+        if (i > 0)
+            params += ", ";
+        params += param;
+        if (named)
+            params += (param.back() == '*' ? "a" : " a") + std::to_string(i);
+    }
+    if (type->isVarArg())
+        params += params.empty() ? "..." : ", ...";
+    if (params.empty())
+        params = "void";
+
+    proto = ret + (ret.back() == '*' ? "" : " ") + name + "(" + params + ")";
+    return true;
+}
+
+/*
+ * Write a C source file which, compiled and linked with the variant
+ * objects, binds every function to the first variant the running CPU
+ * supports through GNU ifuncs. Variants are tried in command line order,
+ * the ones without a feature list or a specific CPU always match.
+ */
+static bool writeDispatchStub(Module &module,
+                              const std::vector<TargetSpec> &specs,
+                              const std::vector<std::string> &suffixes,
+                              const string &filename)
+{
+    std::error_code EC;
+    raw_fd_ostream dest(filename.c_str(), EC, sys::fs::F_Text);
+    if (EC) {
+        errs() << "can't open " << filename << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    dest << "/* Generated by c2ir: load time dispatch between variants */\n";
+    for (auto &F : module) {
+        if (F.isDeclaration() || !F.hasExternalLinkage())
+            continue;
+        std::string name = F.getName().str();
+        std::string proto, error;
+
+        dest << "\n";
+        for (auto &suffix : suffixes) {
+            if (!cPrototype(F, name + "__" + suffix, false, proto, error)) {
+                errs() << error << "\n";
+                return false;
+            }
+            dest << "extern " << proto << ";\n";
+        }
+
+        dest << "\nstatic void *" << name << "_resolver(void)\n{\n";
+        dest << "    __builtin_cpu_init();\n";
+        for (size_t i = 0; i < specs.size(); i++) {
+            std::string cond;
+            dispatchCondition(specs[i], cond, error);
+            std::string variant = name + "__" + suffixes[i];
+            if (cond.empty()) {
+                dest << "    return (void *)" << variant << ";\n";
+                break;
+            }
+            dest << "    if (" << cond << ")\n";
+            dest << "        return (void *)" << variant << ";\n";
+            if (i == specs.size() - 1)
+                dest << "    return (void *)" << variant << ";\n";
+        }
+        dest << "}\n";
+
+        /* main can't be an ifunc, the C runtime calls it directly */
+        if (name == "main") {
+            std::string pointer, args;
+            FunctionType *type = F.getFunctionType();
+            cPrototype(F, "(*)", false, pointer, error);
+            for (unsigned i = 0; i < type->getNumParams(); i++)
+                args += (i > 0 ? ", a" : "a") + std::to_string(i);
+            cPrototype(F, name, true, proto, error);
+            dest << "\n" << proto << "\n{\n    "
+                 << (type->getReturnType()->isVoidTy() ? "" : "return ")
+                 << "((" << pointer << ")main_resolver())(" << args
+                 << ");\n}\n";
+        } else {
+            cPrototype(F, name, false, proto, error);
+            dest << proto << " __attribute__((ifunc(\"" << name
+                 << "_resolver\")));\n";
+        }
+    }
+
+    outs() << "Dispatch stub wrote to " << filename.c_str() << "\n";
+    return true;
+}
+
+/*
+ * Emit one object per target from the IR generated once. Each target runs
+ * on its own thread with its own LLVMContext, which is not thread safe, so
+ * the module is handed over as bitcode instead of CloneModule(). Objects are
+ * named <stem>.<cpu>.o. Fails if any of them or the stub wasn't written.
+ */
+bool ObjGenMultiTarget(CodeGenContext &context,
+                       const std::vector<TargetSpec> &specs,
+                       const string &stem, bool dispatch,
+                       const OptOptions &opt = OptOptions())
+{
+    /* Refuse a stub the C compiler can't build before any codegen */
+    for (auto &spec : specs) {
+        std::string cond, error;
+        if (dispatch && !dispatchCondition(spec, cond, error)) {
+            errs() << spec.triple << ":" << spec.cpu << ": " << error << "\n";
+            return false;
+        }
+    }
+
+    /* Before the workers look targets up, emitObject() reports failures */
+    for (auto &spec : specs) {
+        std::string error;
+        ensureTarget(spec.triple.empty() ? sys::getDefaultTargetTriple()
+                                         : spec.triple,
+                     error);
+    }
+
+    SmallVector<char, 0> bitcode;
+    raw_svector_ostream os(bitcode);
+    WriteBitcodeToFile(*context.module, os);
+    MemoryBufferRef buffer(StringRef(bitcode.data(), bitcode.size()), stem);
+
+    std::vector<std::string> suffixes;
+    for (size_t i = 0; i < specs.size(); i++) {
+        std::string suffix = variantSuffix(specs[i]);
+        if (std::find(suffixes.begin(), suffixes.end(), suffix) !=
+            suffixes.end())
+            suffix += "_" + std::to_string(i);
+        suffixes.push_back(suffix);
+    }
+
+    /* One record per object, next to it */
+    OptOptions targetOpt = opt;
+    targetOpt.remarksFile.clear();
+
+    std::vector<std::string> errors(specs.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < specs.size(); i++) {
+        workers.emplace_back([&, i] {
+            LLVMContext llvmContext;
+            auto module = parseBitcodeFile(buffer, llvmContext);
+            if (!module) {
+                errors[i] = toString(module.takeError());
+                return;
+            }
+            if (dispatch)
+                renameForVariant(**module, suffixes[i]);
+            emitObject(**module, specs[i], targetOpt,
+                       stem + "." + suffixes[i] + ".o", errors[i]);
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    bool ok = true;
+    for (size_t i = 0; i < specs.size(); i++) {
+        std::string object = stem + "." + suffixes[i] + ".o";
+        if (!errors[i].empty()) {
+            errs() << specs[i].triple << ":" << specs[i].cpu << ": "
+                   << errors[i] << "\n";
+            ok = false;
+            continue;
+        }
+        outs() << "Object code wrote to " << object << "\n";
+        if (opt.saveRemarks)
+            outs() << "Optimization remarks wrote to "
+                   << remarksFilename(object, targetOpt) << "\n";
+    }
 
-    return;
+    /* A stub naming a missing variant wouldn't link */
+    if (ok && dispatch)
+        ok = writeDispatchStub(*context.module, specs, suffixes,
+                               stem + ".dispatch.c");
+    return ok;
 }
 
 #endif
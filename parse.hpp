@@ -0,0 +1,172 @@
+#ifndef __PARSE_H__
+#define __PARSE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ASTnode.hpp"
+#include "lexer.hpp"
+
+using namespace std;
+
+struct ParseChunk {
+    size_t begin;
+    size_t end;
+    int line; /* source line and column of begin */
+    int column;
+};
+
+static bool readInput(FILE *in, string &input)
+{
+    char buf[1 << 16];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        input.append(buf, n);
+    return !ferror(in);
+}
+
+/*
+ * Split input after every ';' or '}' which ends a construct at brace depth
+ * zero: function definitions, extern prototypes and global declarations.
+ * Literals can't hold ';' or braces, so no lexing is needed. Chunks are at
+ * least minSize bytes.
+ *
+ * Headers are only valid at the start of the program, the whole input is
+ * one chunk when a '#' comes later, so that the error is reported as by a
+ * serial parse.
+ */
+static vector<ParseChunk> splitTopLevel(const string &input, size_t minSize)
+{
+    vector<ParseChunk> chunks;
+    ParseChunk chunk = { 0, 0, 1, 1 };
+    int depth = 0;
+    int line = 1;
+    size_t lineStart = 0;
+
+    for (size_t i = 0; i < input.size() && depth >= 0; i++) {
+        switch (input[i]) {
+        case '\n':
+            line++;
+            lineStart = i + 1;
+            continue;
+        case '#':
+            if (!chunks.empty())
+                return { { 0, input.size(), 1, 1 } };
+            continue;
+        case '{':
+            depth++;
+            continue;
+        case '}':
+            depth--;
+            break;
+        case ';':
+            break;
+        default:
+            continue;
+        }
+
+        if (depth == 0 && i + 1 - chunk.begin >= minSize) {
+            chunk.end = i + 1;
+            chunks.push_back(chunk);
+            chunk = { i + 1, 0, line, (int)(i + 1 - lineStart) + 1 };
+        }
+    }
+
+    chunk.end = input.size();
+    if (chunks.empty() ||
+        input.find_first_not_of(" \t\n", chunk.begin) != string::npos)
+        chunks.push_back(chunk);
+    return chunks;
+}
+
+static void parseChunk(const string &input, const ParseChunk &chunk,
+                       ParseState &state)
+{
+    state.scanner = lexerCreate(input.data() + chunk.begin,
+                                chunk.end - chunk.begin, chunk.line,
+                                chunk.column);
+    yyparse(&state);
+    state.terminated = lexerTerminated(state.scanner);
+    lexerDestroy(state.scanner);
+    state.scanner = nullptr;
+}
+
+/*
+ * Parse input into one program block. With more than one thread, the top
+ * level constructs are parsed in chunks on a pool of threads and stitched
+ * back in source order. Only the first syntax error in source order is
+ * reported, and parsing stops at an unknown token, as a serial parse does.
+ */
+static NBlock *parseProgram(const string &input, const string &filename,
+                            unsigned threads)
+{
+    vector<ParseChunk> chunks;
+    if (threads > 1)
+        chunks = splitTopLevel(
+            input, max<size_t>(input.size() / (threads * 8), 4096));
+    else
+        chunks.push_back({ 0, input.size(), 1, 1 });
+
+    vector<ParseState> states(chunks.size());
+    for (auto &state : states)
+        state.filename = filename;
+
+    atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i; (i = next++) < chunks.size();)
+            parseChunk(input, chunks[i], states[i]);
+    };
+
+    vector<thread> workers;
+    for (size_t t = 1; t < min<size_t>(threads, chunks.size()); t++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &w : workers)
+        w.join();
+
+    /*
+     * The chunks past the first failing one were lexed too, their unknown
+     * tokens are only reported up to there, as a serial parse stops.
+     */
+    if (states.size() == 1) {
+        if (states[0].terminated)
+            fputs("Unknown token", stdout);
+        if (!states[0].error.empty()) {
+            puts(states[0].error.c_str());
+            return nullptr;
+        }
+        return states[0].program;
+    }
+
+    NBlock *program = new NBlock();
+    for (size_t i = 0; i < states.size(); i++) {
+        ParseState &state = states[i];
+        if (state.terminated)
+            fputs("Unknown token", stdout);
+
+        /* Whitespace or ignored tokens only, serially they change nothing */
+        if (i > 0 && state.tokens == 0) {
+            if (state.terminated)
+                break;
+            continue;
+        }
+        if (!state.error.empty()) {
+            puts(state.error.c_str());
+            return nullptr;
+        }
+
+        program->statements->insert(program->statements->end(),
+                                    state.program->statements->begin(),
+                                    state.program->statements->end());
+        if (state.terminated)
+            break;
+    }
+    return program;
+}
+
+#endif /* __PARSE_H__ */
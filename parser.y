@@ -2,14 +2,44 @@
     #include "ASTnode.hpp"
     #include <vector>
     #include <cstdio>
-    NBlock *programBlock;
+%}
+
+%code requires {
+    struct ParseState;
+}
 
-    extern int yylex();
-    void yyerror(const char *s)
+%code {
+    #include "lexer.hpp"
+
+    static int yylex(YYSTYPE *lval, YYLTYPE *lloc, ParseState *state)
     {
-        printf("ERROR: %s:%d: %s\n", __FILE__, __LINE__, s);
+        int token = lexerLex(lval, lloc, state->scanner);
+        if (token)
+            state->tokens++;
+        return token;
     }
-%}
+
+    /* The source location of the first token of the rule */
+    template <class T> static T *at(T *node, const YYLTYPE &loc)
+    {
+        node->line = loc.first_line;
+        node->column = loc.first_column;
+        return node;
+    }
+
+    /* Kept, not printed, so that parallel parses report in source order */
+    void yyerror(YYLTYPE *lloc, ParseState *state, const char *s)
+    {
+        if (state->error.empty())
+            state->error = "ERROR: " + state->filename + ":" +
+                           std::to_string(lloc->first_line) + ":" +
+                           std::to_string(lloc->first_column) + ": " + s;
+    }
+}
+
+%define api.pure full
+%parse-param { ParseState *state }
+%lex-param { ParseState *state }
 
 %union {
     Node *node;
@@ -22,6 +52,7 @@
     NVariableDeclaration *var_decl;
     vector<NVariableDeclaration *> *varvec;
     vector<NExpression *> *exprvec;
+    vector<std::string> *strvec;
     
     std::string *string;
     int token;
@@ -37,9 +68,10 @@
 %token <token>      T_EQUAL
 //%token <token>      T_CMP_EQUAL
 
-%token <token>      T_COMMA T_LPAREN T_RPAREN T_LBRACE T_RBRACE
+%token <token>      T_COMMA T_LPAREN T_RPAREN T_LBRACE T_RBRACE T_ELLIPSIS
 %token <token>      T_SEQPOINT
 %token <token>      T_EXTERN T_RETURN
+%token <token>      T_ATTRIBUTE
 
 %type <block> program program_unit stmts block
 %type <stmt> stmt var_decl func_decl
@@ -49,25 +81,48 @@
 
 %type <varvec> func_decl_args
 %type <exprvec> call_args
+%type <strvec> func_attrs attr_list
 
 /* operater precendence */
 %left T_ADD T_MINUS
 
 %start program
 
+%locations
+
 %%
 
 program             : program_unit
                     ;
 
 program_unit        : T_HEADER program_unit { $$ = $2; }
-                    | stmts { programBlock = $1; puts("parser program block"); }
+                    | stmts { state->program = $1; puts("parser program block"); }
                     ;
 
 func_decl           : T_EXTERN typename ident T_LPAREN func_decl_args T_RPAREN T_SEQPOINT
                       { $$ = new NFunctionDeclaration($2, $3, $5, nullptr); }
+                    | T_EXTERN typename ident T_LPAREN func_decl_args T_COMMA T_ELLIPSIS T_RPAREN T_SEQPOINT
+                      {
+                        NFunctionDeclaration *func = new NFunctionDeclaration($2, $3, $5, nullptr);
+                        func->isVarArg = true;
+                        $$ = func;
+                      }
                     | typename ident T_LPAREN func_decl_args T_RPAREN block
                       { $$ = new NFunctionDeclaration($1, $2, $4, $6); }
+                    | func_attrs typename ident T_LPAREN func_decl_args T_RPAREN block
+                      {
+                        NFunctionDeclaration *func = new NFunctionDeclaration($2, $3, $5, $7);
+                        func->attributes = *$1;
+                        delete $1;
+                        $$ = func;
+                      }
+                    ;
+
+func_attrs          : T_ATTRIBUTE T_LPAREN T_LPAREN attr_list T_RPAREN T_RPAREN { $$ = $4; }
+                    ;
+
+attr_list           : T_IDENTIFIER { $$ = new vector<string>(); $$->push_back(*$1); delete $1; }
+                    | attr_list T_COMMA T_IDENTIFIER { $1->push_back(*$3); delete $3; }
                     ;
 
 call_args           : { $$ = new ExpressionList(); }
@@ -92,16 +147,17 @@ stmts               : stmt { $$ = new NBlock();  $$->statements->push_back($1);
                     | stmts stmt { $1->statements->push_back($2); }
                     ;
 
-stmt                : var_decl T_SEQPOINT | func_decl
-                    | expr T_SEQPOINT { $$ = new NExpressionStatement($1); }
-                    | T_RETURN expr T_SEQPOINT { $$ = new NReturnStatement($2); }
+stmt                : var_decl T_SEQPOINT { $$ = at($1, @1); }
+                    | func_decl { $$ = at($1, @1); }
+                    | expr T_SEQPOINT { $$ = at(new NExpressionStatement($1), @1); }
+                    | T_RETURN expr T_SEQPOINT { $$ = at(new NReturnStatement($2), @1); }
                     ;
 
 expr                : ident { $<ident>$ = $1; }
                     | T_LPAREN ident T_RPAREN { $<ident>$ = $2; }
                     | numeric
                     | T_LITERAL { $$ = new NLiteral(*$1); delete $1; }
-                    | ident T_LPAREN call_args T_RPAREN { $$ = new NMethodCall($1, $3); }
+                    | ident T_LPAREN call_args T_RPAREN { $$ = at(new NMethodCall($1, $3), @1); }
                     | ident T_EQUAL expr { $$ = new NAssignment($1, $3); }
                     | ident T_ADD expr { $$ = new NBinaryOperator($1, $2, $3); } 
                     | ident T_MINUS expr { $$ = new NBinaryOperator($1, $2, $3); } 
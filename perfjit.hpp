@@ -0,0 +1,101 @@
+#ifndef __PERFJIT_H__
+#define __PERFJIT_H__
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <unistd.h>
+#include <string>
+
+using namespace llvm;
+
+/*
+ * Writes one "START SIZE symbolname" line per JIT-ed function to
+ * /tmp/perf-PID.map, the format perf falls back to for anonymous
+ * executable memory. It needs no perf support in the LLVM build, unlike
+ * the jitdump listener below.
+ */
+class PerfMapEventListener : public JITEventListener {
+    std::unique_ptr<raw_fd_ostream> map;
+
+public:
+    PerfMapEventListener()
+    {
+        std::error_code EC;
+        std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        map = std::make_unique<raw_fd_ostream>(path, EC, sys::fs::F_Append);
+        if (EC) {
+            errs() << "can't open " << path << ": " << EC.message() << "\n";
+            map.reset();
+        }
+    }
+
+    void notifyObjectLoaded(ObjectKey K, const object::ObjectFile &obj,
+                            const RuntimeDyld::LoadedObjectInfo &L) override
+    {
+        if (!map)
+            return;
+
+        /* The debug object has its sections relocated to the load address */
+        object::OwningBinary<object::ObjectFile> debugObjOwner =
+            L.getObjectForDebug(obj);
+        const object::ObjectFile *debugObj = debugObjOwner.getBinary();
+        if (!debugObj)
+            return;
+
+        for (const auto &P : object::computeSymbolSizes(*debugObj)) {
+            object::SymbolRef sym = P.first;
+
+            Expected<object::SymbolRef::Type> type = sym.getType();
+            if (!type) {
+                consumeError(type.takeError());
+                continue;
+            }
+            if (*type != object::SymbolRef::ST_Function)
+                continue;
+
+            Expected<StringRef> name = sym.getName();
+            Expected<uint64_t> addr = sym.getAddress();
+            if (!name || !addr) {
+                if (!name)
+                    consumeError(name.takeError());
+                if (!addr)
+                    consumeError(addr.takeError());
+                continue;
+            }
+
+            *map << format_hex_no_prefix(*addr, 1) << " "
+                 << format_hex_no_prefix(P.second, 1) << " " << *name << "\n";
+        }
+        map->flush();
+    }
+};
+
+/*
+ * Attach the perf listeners to the execution engine. Must be called before
+ * finalizeObject(), which is when MCJIT emits and loads the object.
+ *
+ * The jitdump listener also carries the line table of the module, so the
+ * module should be generated with debug info for perf to resolve
+ * source lines.
+ */
+static inline void registerPerfListeners(ExecutionEngine *ee)
+{
+    static PerfMapEventListener perfMap;
+    ee->RegisterJITEventListener(&perfMap);
+
+    JITEventListener *jitdump = JITEventListener::createPerfJITEventListener();
+    if (jitdump)
+        ee->RegisterJITEventListener(jitdump);
+    else
+        errs() << "LLVM is built without perf support (LLVM_USE_PERF), "
+                  "only /tmp/perf-PID.map is written\n";
+}
+
+#endif /* __PERFJIT_H__ */
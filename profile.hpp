@@ -0,0 +1,196 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+/*
+ * Function weights for the hot-first layout, read from either
+ *
+ *   - `perf script` output, one sample per line or a callchain per
+ *     blank-line separated block (-g), only the leaf frame is counted:
+ *       c2ir 1234 10.5:  250000 cycles:u:  401136 do_math+0x16 (/a.out)
+ *
+ *   - an LLVM text sample profile, `function:total:head` header lines
+ *     (llvm-profdata show -sample, or create_llvm_prof output).
+ */
+typedef StringMap<uint64_t> FunctionWeights;
+
+/* "401136 do_math+0x16 (/a.out)" -> "do_math" */
+static StringRef parsePerfFrame(StringRef line)
+{
+    if (!line.endswith(")"))
+        return StringRef();
+    size_t dso = line.rfind(" (");
+    if (dso == StringRef::npos)
+        return StringRef();
+
+    StringRef frame = line.take_front(dso).rtrim();
+    size_t space = frame.find_last_of(" \t");
+    if (space == StringRef::npos)
+        return StringRef();
+    StringRef sym = frame.drop_front(space + 1);
+    sym = sym.take_front(sym.rfind("+0x"));
+    if (sym.empty() || sym == "[unknown]")
+        return StringRef();
+    return sym;
+}
+
+/* "do_math:1234:56" -> "do_math", 1234 */
+static bool parseSampleProfileHeader(StringRef line, StringRef &name,
+                                     uint64_t &total)
+{
+    if (line.empty() || isspace(line[0]))
+        return false;
+
+    StringRef rest = line.rtrim(), totalStr, headStr;
+    uint64_t head;
+    std::tie(rest, headStr) = rest.rsplit(':');
+    std::tie(name, totalStr) = rest.rsplit(':');
+    return !name.empty() && name.find_first_of(" \t") == StringRef::npos &&
+           !totalStr.getAsInteger(10, total) && !headStr.getAsInteger(10, head);
+}
+
+static bool readProfile(const std::string &path, FunctionWeights &weights,
+                        std::string &error)
+{
+    auto buffer = MemoryBuffer::getFileOrSTDIN(path);
+    if (!buffer) {
+        error = "can't read " + path + ": " + buffer.getError().message();
+        return false;
+    }
+
+    enum { SAMPLE, LEAF, STACK } state = SAMPLE;
+    SmallVector<StringRef, 0> lines;
+    (*buffer)->getBuffer().split(lines, '\n');
+
+    for (StringRef line : lines) {
+        StringRef name;
+        uint64_t total;
+        if (parseSampleProfileHeader(line, name, total)) {
+            weights[name] += total;
+            continue;
+        }
+
+        line = line.trim();
+        if (line.empty()) {
+            state = SAMPLE;
+            continue;
+        }
+
+        switch (state) {
+        case SAMPLE:
+            /* A header ending with the event name, its callchain follows */
+            if (line.endswith(":")) {
+                state = LEAF;
+                break;
+            }
+            name = parsePerfFrame(line);
+            if (!name.empty())
+                weights[name]++;
+            break;
+        case LEAF:
+            name = parsePerfFrame(line);
+            if (!name.empty())
+                weights[name]++;
+            state = STACK;
+            break;
+        case STACK:
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The functions module defines, hottest first. Functions without samples
+ * keep their source order after the sampled ones.
+ */
+static std::vector<Function *> hotFirstOrder(Module &module,
+                                             const FunctionWeights &weights)
+{
+    std::vector<Function *> order;
+    for (auto &F : module)
+        if (!F.isDeclaration())
+            order.push_back(&F);
+
+    std::stable_sort(order.begin(), order.end(),
+                     [&](Function *a, Function *b) {
+                         return weights.lookup(a->getName()) >
+                                weights.lookup(b->getName());
+                     });
+    return order;
+}
+
+/* Lay the functions of the object out hot-first, codegen follows this order */
+static void orderFunctions(Module &module, const FunctionWeights &weights)
+{
+    for (Function *F : hotFirstOrder(module, weights)) {
+        F->removeFromParent();
+        module.getFunctionList().push_back(F);
+    }
+}
+
+/* The sampled functions module defines, hottest first */
+static std::vector<std::string> hotSymbols(Module &module,
+                                           const FunctionWeights &weights)
+{
+    std::vector<std::string> symbols;
+    for (Function *F : hotFirstOrder(module, weights))
+        if (weights.lookup(F->getName()))
+            symbols.push_back(F->getName().str());
+    return symbols;
+}
+
+/*
+ * Every sampled symbol hottest first, those of equal weight by name, for a
+ * profile of a whole program without its source.
+ */
+static std::vector<std::string> hotSymbols(const FunctionWeights &weights)
+{
+    std::vector<std::string> symbols;
+    for (auto &entry : weights)
+        if (entry.getValue())
+            symbols.push_back(entry.getKey().str());
+
+    std::sort(symbols.begin(), symbols.end(),
+              [&](const std::string &a, const std::string &b) {
+                  uint64_t x = weights.lookup(a), y = weights.lookup(b);
+                  return x != y ? x > y : a < b;
+              });
+    return symbols;
+}
+
+/*
+ * Write symbols one per line, for lld's --symbol-ordering-file. Needs
+ * -ffunction-sections for the linker to be able to move them.
+ */
+static bool writeSymbolOrderingFile(const std::vector<std::string> &symbols,
+                                    const std::string &path)
+{
+    std::error_code EC;
+    raw_fd_ostream dest(path, EC, sys::fs::F_Text);
+    if (EC) {
+        errs() << "can't open " << path << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    for (auto &symbol : symbols)
+        dest << symbol << "\n";
+
+    outs() << "Symbol ordering wrote to " << path << "\n";
+    return true;
+}
+
+#endif /* __PROFILE_H__ */
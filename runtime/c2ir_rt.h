@@ -0,0 +1,49 @@
+#ifndef __C2IR_RT_H__
+#define __C2IR_RT_H__
+
+/*
+ * Runtime of the c2ir builtins, built into libc2ir_rt.a by `make runtime`
+ * and linked next to the object c2ir writes:
+ *
+ *   clang -o prog text.o libc2ir_rt.a -lpthread
+ *
+ * c2ir itself links it too, for -jit.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runs worker on subranges of [begin, end) */
+typedef void (*c2ir_range_fn)(int begin, int end);
+
+/*
+ * parallel_for(lo, hi, body): run worker over [lo, hi) on a work-stealing
+ * pool of C2IR_NUM_THREADS threads (default one per core), the calling
+ * thread included. Returns when every iteration is done, nested calls run
+ * serially on the calling thread. Returns 0.
+ */
+int c2ir_parallel_for(int lo, int hi, c2ir_range_fn worker);
+
+/*
+ * Buffered stdout, see io.c. echo and printf calls with a constant format
+ * of %d, %i, %c, %s and %% are lowered to the writers, other printf calls
+ * to c2ir_printf() and puts() to c2ir_puts(), unless -buffered-io=false.
+ * The writers return the number of bytes written.
+ */
+int c2ir_write(const char *s, int len);
+int c2ir_write_str(const char *s);
+int c2ir_write_char(int c);
+int c2ir_write_int(int value);
+int c2ir_puts(const char *s);
+int c2ir_printf(const char *format, ...);
+/* Write the calling thread's buffer out */
+void c2ir_flush(void);
+/* Write every thread's buffer out, run at exit */
+void c2ir_flush_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __C2IR_RT_H__ */
@@ -0,0 +1,233 @@
+/*
+ * Buffered output behind echo, printf and puts.
+ *
+ * Every thread writes into its own buffer, so no writer takes a lock, and
+ * a full buffer goes out in one write(2). The buffers are flushed when
+ * their thread exits and, all of them, when the program exits. When stdout
+ * is a terminal, a write holding a newline flushes, as stdio does.
+ *
+ * Output of different threads interleaves a buffer at a time. A full buffer
+ * only writes up to its last newline, so lines shorter than a buffer are
+ * not torn apart. At exit the other threads must not be writing anymore,
+ * the parallel_for pool is idle between jobs.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "c2ir_rt.h"
+
+#define IO_BUFSIZE (64 * 1024)
+
+struct io_buffer {
+    size_t len;
+    struct io_buffer *next; /* every thread's buffer, for the exit flush */
+    char data[IO_BUFSIZE];
+};
+
+static _Thread_local struct io_buffer *tls_buffer;
+static _Atomic(struct io_buffer *) buffers;
+
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+static pthread_key_t io_key;
+static int line_buffered;
+
+static void write_all(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void flush_buffer(struct io_buffer *buffer)
+{
+    write_all(buffer->data, buffer->len);
+    buffer->len = 0;
+}
+
+/* Write up to the last newline, keep the partial line */
+static void flush_lines(struct io_buffer *buffer)
+{
+    size_t len = buffer->len;
+
+    while (len > 0 && buffer->data[len - 1] != '\n')
+        len--;
+    if (len == 0)
+        return;
+    write_all(buffer->data, len);
+    buffer->len -= len;
+    memmove(buffer->data, buffer->data + len, buffer->len);
+}
+
+static void flush_at_thread_exit(void *buffer)
+{
+    flush_buffer(buffer);
+}
+
+static void io_init(void)
+{
+    pthread_key_create(&io_key, flush_at_thread_exit);
+    line_buffered = isatty(STDOUT_FILENO);
+    atexit(c2ir_flush_all);
+}
+
+static struct io_buffer *get_buffer(void)
+{
+    struct io_buffer *buffer = tls_buffer;
+
+    if (buffer)
+        return buffer;
+
+    pthread_once(&io_once, io_init);
+    buffer = malloc(sizeof(*buffer));
+    if (!buffer)
+        abort();
+    buffer->len = 0;
+    buffer->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer))
+        ;
+    pthread_setspecific(io_key, buffer);
+    return tls_buffer = buffer;
+}
+
+/* Room for len more bytes, or NULL when len doesn't fit even when empty */
+static char *reserve(struct io_buffer *buffer, size_t len)
+{
+    if (buffer->len + len > IO_BUFSIZE)
+        flush_lines(buffer);
+    if (buffer->len + len > IO_BUFSIZE)
+        flush_buffer(buffer);
+    if (len > IO_BUFSIZE)
+        return NULL;
+    return buffer->data + buffer->len;
+}
+
+static void commit(struct io_buffer *buffer, size_t len)
+{
+    const char *data = buffer->data + buffer->len;
+
+    buffer->len += len;
+    if (line_buffered && memchr(data, '\n', len))
+        flush_buffer(buffer);
+}
+
+int c2ir_write(const char *s, int len)
+{
+    struct io_buffer *buffer = get_buffer();
+    char *p = reserve(buffer, len);
+
+    if (!p) {
+        write_all(s, len);
+        return len;
+    }
+    memcpy(p, s, len);
+    commit(buffer, len);
+    return len;
+}
+
+int c2ir_write_str(const char *s)
+{
+    return c2ir_write(s, strlen(s));
+}
+
+int c2ir_write_char(int c)
+{
+    struct io_buffer *buffer = get_buffer();
+    char *p = reserve(buffer, 1);
+
+    *p = c;
+    commit(buffer, 1);
+    return 1;
+}
+
+int c2ir_write_int(int value)
+{
+    struct io_buffer *buffer = get_buffer();
+    char digits[12], *end = digits + sizeof(digits), *p = end;
+    /* Negate as unsigned, INT_MIN has no positive int */
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    int len;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0)
+        *--p = '-';
+
+    len = end - p;
+    memcpy(reserve(buffer, len), p, len);
+    commit(buffer, len);
+    return len;
+}
+
+int c2ir_puts(const char *s)
+{
+    return c2ir_write_str(s) + c2ir_write_char('\n');
+}
+
+int c2ir_printf(const char *format, ...)
+{
+    struct io_buffer *buffer = get_buffer();
+    size_t room = IO_BUFSIZE - buffer->len;
+    va_list args;
+    char *p;
+    int len;
+
+    /* Format in place, vsnprintf needs room for the NUL too */
+    va_start(args, format);
+    len = vsnprintf(buffer->data + buffer->len, room, format, args);
+    va_end(args);
+    if (len < 0)
+        return len;
+
+    if ((size_t)len >= room) {
+        va_start(args, format);
+        p = reserve(buffer, len + 1);
+        if (p) {
+            vsnprintf(p, len + 1, format, args);
+        } else {
+            /* Larger than a whole buffer, format it aside */
+            p = malloc(len + 1);
+            if (p) {
+                vsnprintf(p, len + 1, format, args);
+                write_all(p, len);
+                free(p);
+            } else {
+                len = -1;
+            }
+            va_end(args);
+            return len;
+        }
+        va_end(args);
+    }
+
+    commit(buffer, len);
+    return len;
+}
+
+void c2ir_flush(void)
+{
+    if (tls_buffer)
+        flush_buffer(tls_buffer);
+}
+
+void c2ir_flush_all(void)
+{
+    for (struct io_buffer *buffer = atomic_load(&buffers); buffer;
+         buffer = buffer->next)
+        flush_buffer(buffer);
+}
@@ -0,0 +1,228 @@
+/*
+ * Work-stealing pool behind parallel_for.
+ *
+ * c2ir outlines parallel_for(lo, hi, body) into a worker running body over
+ * a subrange, and calls c2ir_parallel_for() with it. The range is split
+ * evenly over one slot per thread. Each thread takes grain sized chunks
+ * from the front of its own slot and, once it is empty, steals the back
+ * half of another slot. A slot is a [begin, end) pair packed into one
+ * 64 bit word, so that both taking and stealing are a single CAS.
+ *
+ * The pool threads are started on the first call and sleep on a condition
+ * variable between jobs. The job lives on the caller's stack. Once the
+ * caller finds no range left to take or steal, it withdraws the job and
+ * sleeps until the pool threads still running a chunk have left it.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "c2ir_rt.h"
+
+#define MAX_THREADS 64
+#define CACHE_LINE 64
+
+/* Chunks per thread a range is cut into at least, before stealing */
+#define CHUNKS_PER_THREAD 8
+
+struct slot {
+    _Alignas(CACHE_LINE) _Atomic uint64_t range;
+};
+
+struct job {
+    c2ir_range_fn worker;
+    long long grain;
+    int nslots;
+    struct slot slots[MAX_THREADS];
+    int active; /* pool threads inside the job, under pool.lock */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done; /* the last pool thread left the job */
+    struct job *job;     /* the running job, NULL between jobs */
+    unsigned long generation;
+    int nthreads; /* pool threads and the caller */
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER, NULL, 0, 0 };
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+/* One job at a time, other concurrent calls run serially */
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The calling thread is running a body, nested calls run serially */
+static _Thread_local int in_parallel;
+
+static inline uint64_t pack(int begin, int end)
+{
+    return (uint64_t)(uint32_t)begin << 32 | (uint32_t)end;
+}
+
+static inline int range_begin(uint64_t range)
+{
+    return (int)(uint32_t)(range >> 32);
+}
+
+static inline int range_end(uint64_t range)
+{
+    return (int)(uint32_t)range;
+}
+
+/* Take the next chunk from the front of our own slot */
+static int take(struct job *job, int self, int *begin, int *end)
+{
+    _Atomic uint64_t *slot = &job->slots[self].range;
+    uint64_t range = atomic_load(slot);
+
+    for (;;) {
+        int b = range_begin(range), e = range_end(range);
+        long long n = (long long)e - b;
+
+        if (n <= 0)
+            return 0;
+        if (n > job->grain)
+            n = job->grain;
+        if (atomic_compare_exchange_weak(slot, &range, pack(b + n, e))) {
+            *begin = b;
+            *end = b + n;
+            return 1;
+        }
+    }
+}
+
+/* Move the back half of another slot into our own, which is empty */
+static int steal(struct job *job, int self)
+{
+    for (int k = 1; k < job->nslots; k++) {
+        _Atomic uint64_t *victim = &job->slots[(self + k) % job->nslots].range;
+        uint64_t range = atomic_load(victim);
+
+        for (;;) {
+            int b = range_begin(range), e = range_end(range);
+            long long n = (long long)e - b;
+
+            if (n <= 0)
+                break;
+            int mid = e - (int)((n + 1) / 2);
+            if (atomic_compare_exchange_weak(victim, &range, pack(b, mid))) {
+                atomic_store(&job->slots[self].range, pack(mid, e));
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void run_job(struct job *job, int self)
+{
+    int begin, end;
+
+    do {
+        while (take(job, self, &begin, &end))
+            job->worker(begin, end);
+    } while (steal(job, self));
+}
+
+static void *pool_thread(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+
+    in_parallel = 1;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+
+        /* Woken too late, the job is already done */
+        struct job *job = pool.job;
+        if (!job)
+            continue;
+
+        job->active++;
+        pthread_mutex_unlock(&pool.lock);
+        run_job(job, self);
+        pthread_mutex_lock(&pool.lock);
+        if (--job->active == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+static void pool_init(void)
+{
+    const char *env = getenv("C2IR_NUM_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_attr_t attr;
+
+    if (n < 1)
+        n = 1;
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pool.nthreads = 1;
+    for (long i = 1; i < n; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, pool_thread, (void *)(intptr_t)i))
+            break;
+        pool.nthreads++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+int c2ir_parallel_for(int lo, int hi, c2ir_range_fn worker)
+{
+    long long len = (long long)hi - lo;
+    struct job job;
+
+    if (len <= 0)
+        return 0;
+
+    pthread_once(&pool_once, pool_init);
+    if (in_parallel || pool.nthreads == 1 || len == 1 ||
+        pthread_mutex_trylock(&submit_lock)) {
+        worker(lo, hi);
+        return 0;
+    }
+
+    job.worker = worker;
+    job.nslots = pool.nthreads;
+    job.grain = len / (job.nslots * CHUNKS_PER_THREAD);
+    if (job.grain < 1)
+        job.grain = 1;
+    for (int k = 0; k < job.nslots; k++)
+        atomic_init(&job.slots[k].range,
+                    pack(lo + len * k / job.nslots,
+                         lo + len * (k + 1) / job.nslots));
+    job.active = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_parallel = 1;
+    run_job(&job, 0);
+
+    /*
+     * Every range is taken, the rest runs in the pool threads inside the
+     * job. A range in transit between two slots belongs to the thread
+     * stealing it, which is inside the job too.
+     */
+    pthread_mutex_lock(&pool.lock);
+    pool.job = NULL;
+    while (job.active > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    in_parallel = 0;
+
+    pthread_mutex_unlock(&submit_lock);
+    return 0;
+}
@@ -0,0 +1,405 @@
+#ifndef __SEMA_H__
+#define __SEMA_H__
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ASTnode.hpp"
+
+using namespace std;
+
+/*
+ * Semantic analysis, run between parsing and codegen.
+ *
+ * Binds every variable NIdentifier to its NVariableDeclaration and every
+ * NMethodCall to its NFunctionDeclaration, so that codegen follows pointers
+ * instead of looking names up, checks argument counts and types, and builds
+ * the call graph of the program's functions.
+ *
+ * Types are "int", "char" and "char*", codegen does no conversion between
+ * them so they must match exactly.
+ *
+ * parallel_for(lo, hi, body) is a builtin, body names a function taking
+ * one int, run for each i in [lo, hi) by the runtime/parallel.c pool.
+ */
+class Sema {
+    string filename;
+    unsigned errors = 0;
+
+    map<string, NFunctionDeclaration *> functions;
+    /* The variables of the function being checked, by name */
+    map<string, NVariableDeclaration *> scope;
+    NFunctionDeclaration *currentFunction = nullptr;
+    /* Location of the errors reported next */
+    int line = 0;
+    int column = 0;
+
+public:
+    /* Defined functions, in source order */
+    vector<NFunctionDeclaration *> definitions;
+    /* Caller -> callees, each callee once */
+    map<NFunctionDeclaration *, vector<NFunctionDeclaration *> > callGraph;
+
+    Sema(const string &filename)
+        : filename(filename)
+    {
+        /* The core functions, see corefn.hpp */
+        declareBuiltin("printf", "char", true, true);
+        declareBuiltin("echo", "int", false, false);
+    }
+
+    bool check(NBlock &program)
+    {
+        /* Functions may be called before their definition */
+        for (auto stmt : *program.statements)
+            if (auto func = dynamic_cast<NFunctionDeclaration *>(stmt))
+                declare(func);
+
+        for (auto stmt : *program.statements) {
+            locate(stmt);
+            if (auto func = dynamic_cast<NFunctionDeclaration *>(stmt))
+                checkFunction(func);
+            else
+                error("only function declarations are supported at the top "
+                      "level");
+        }
+        return errors == 0;
+    }
+
+    /* Defined functions with their callees first, recursion cut anywhere */
+    vector<NFunctionDeclaration *> postOrder()
+    {
+        vector<NFunctionDeclaration *> order;
+        set<NFunctionDeclaration *> visited;
+        for (auto func : definitions)
+            visit(func, visited, order);
+        return order;
+    }
+
+    void printCallGraph()
+    {
+        cout << "Call graph:" << endl;
+        for (auto func : definitions) {
+            cout << "    " << func->id->name << " ->";
+            for (auto callee : callGraph[func])
+                cout << " " << callee->id->name;
+            cout << endl;
+        }
+    }
+
+private:
+    void error(const string &message)
+    {
+        cout << "ERROR: " << filename << ":" << line << ":" << column << ": "
+             << message << endl;
+        errors++;
+    }
+
+    void locate(const Node *node)
+    {
+        if (node->line) {
+            line = node->line;
+            column = node->column;
+        }
+    }
+
+    static string typeOf(const NIdentifier *type)
+    {
+        return type->name + (type->isPtr ? "*" : "");
+    }
+
+    void declareBuiltin(const string &name, const string &argType,
+                        bool argIsPtr, bool isVarArg)
+    {
+        NIdentifier *type = new NIdentifier(argType);
+        type->isPtr = argIsPtr;
+        VariableList *args = new VariableList();
+        args->push_back(
+            new NVariableDeclaration(type, new NIdentifier("arg"), nullptr));
+
+        NFunctionDeclaration *func = new NFunctionDeclaration(
+            new NIdentifier("int"), new NIdentifier(name), args, nullptr);
+        func->isVarArg = isVarArg;
+        functions[name] = func;
+    }
+
+    /*
+     * Extern prototypes may repeat a declaration, the calls bind to the
+     * first one, like codegen reuses the first llvm::Function.
+     */
+    void declare(NFunctionDeclaration *func)
+    {
+        locate(func);
+        checkAttributes(func);
+        auto it = functions.find(func->id->name);
+        if (it == functions.end()) {
+            functions[func->id->name] = func;
+            return;
+        }
+
+        NFunctionDeclaration *prev = it->second;
+        if (!func->isExtern && !prev->isExtern) {
+            error("redefinition of function " + func->id->name);
+            return;
+        }
+        if (!func->isExtern)
+            it->second = func;
+        if (!sameSignature(prev, func))
+            error("conflicting declaration of function " + func->id->name);
+    }
+
+    static bool sameSignature(const NFunctionDeclaration *a,
+                              const NFunctionDeclaration *b)
+    {
+        if (a->isVarArg != b->isVarArg || typeOf(a->type) != typeOf(b->type) ||
+            a->arguments->size() != b->arguments->size())
+            return false;
+        for (size_t i = 0; i < a->arguments->size(); i++)
+            if (typeOf((*a->arguments)[i]->type) !=
+                typeOf((*b->arguments)[i]->type))
+                return false;
+        return true;
+    }
+
+    /*
+     * The attributes CodeGenContext::addFunctionAttribute() lowers, and
+     * those which can't go together on one function
+     */
+    void checkAttributes(NFunctionDeclaration *func)
+    {
+        static const char *const known[] = {
+            "hot", "cold", "optsize", "minsize", "noinline", "always_inline",
+        };
+        static const pair<const char *, const char *> conflicts[] = {
+            { "noinline", "always_inline" },
+            { "hot", "cold" },
+        };
+        const vector<string> &attrs = func->attributes;
+        for (auto &attr : attrs)
+            if (std::find(std::begin(known), std::end(known), attr) ==
+                std::end(known))
+                error("unknown attribute " + attr + " on function " +
+                      func->id->name);
+        auto has = [&](const char *attr) {
+            return std::find(attrs.begin(), attrs.end(), attr) != attrs.end();
+        };
+        for (auto &conflict : conflicts)
+            if (has(conflict.first) && has(conflict.second))
+                error(string("attributes ") + conflict.first + " and " +
+                      conflict.second + " conflict on function " +
+                      func->id->name);
+    }
+
+    void declareVariable(NVariableDeclaration *var)
+    {
+        if (scope.count(var->id->name))
+            error("redeclaration of variable " + var->id->name);
+        scope[var->id->name] = var;
+        var->id->decl = var;
+    }
+
+    void checkFunction(NFunctionDeclaration *func)
+    {
+        if (func->isExtern)
+            return;
+
+        definitions.push_back(func);
+        callGraph[func];
+        currentFunction = func;
+        scope.clear();
+
+        for (auto arg : *func->arguments)
+            declareVariable(arg);
+
+        for (auto stmt : *func->block->statements) {
+            locate(stmt);
+            checkStatement(stmt);
+        }
+
+        currentFunction = nullptr;
+    }
+
+    void checkStatement(NStatement *stmt)
+    {
+        if (auto s = dynamic_cast<NExpressionStatement *>(stmt)) {
+            checkExpression(s->expression);
+        } else if (auto s = dynamic_cast<NReturnStatement *>(stmt)) {
+            string type = checkExpression(s->expression);
+            string expected = typeOf(currentFunction->type);
+            if (!type.empty() && type != expected)
+                error("returning " + type + " from " +
+                      currentFunction->id->name + " which returns " +
+                      expected);
+        } else if (auto s = dynamic_cast<NVariableDeclaration *>(stmt)) {
+            /* The initializer can't see the variable it initializes */
+            string type;
+            if (s->assignmentExpr)
+                type = checkExpression(s->assignmentExpr);
+            declareVariable(s);
+            if (!type.empty() && type != typeOf(s->type))
+                error("initializing " + typeOf(s->type) + " " +
+                      s->id->name + " with " + type);
+        } else if (dynamic_cast<NFunctionDeclaration *>(stmt)) {
+            error("nested functions are not supported");
+        }
+    }
+
+    /* Returns the type of expr, empty after an error */
+    string checkExpression(NExpression *expr)
+    {
+        if (dynamic_cast<NInteger *>(expr))
+            return "int";
+        if (dynamic_cast<NLiteral *>(expr))
+            return "char*";
+        if (auto e = dynamic_cast<NIdentifier *>(expr))
+            return checkIdentifier(e);
+
+        if (auto e = dynamic_cast<NBinaryOperator *>(expr)) {
+            string lhs = checkIdentifier(e->lhs);
+            string rhs = checkExpression(e->rhs);
+            if (lhs.empty() || rhs.empty())
+                return "";
+            if (lhs != "int" || rhs != "int") {
+                error("arithmetic on " + lhs + " and " + rhs);
+                return "";
+            }
+            return "int";
+        }
+
+        if (auto e = dynamic_cast<NAssignment *>(expr)) {
+            string lhs = checkIdentifier(e->lhs);
+            string rhs = checkExpression(e->rhs);
+            if (lhs.empty() || rhs.empty())
+                return "";
+            if (lhs != rhs) {
+                error("assigning " + rhs + " to " + lhs + " " + e->lhs->name);
+                return "";
+            }
+            return lhs;
+        }
+
+        if (auto e = dynamic_cast<NMethodCall *>(expr))
+            return checkCall(e);
+
+        error("unsupported expression");
+        return "";
+    }
+
+    string checkIdentifier(NIdentifier *id)
+    {
+        auto it = scope.find(id->name);
+        if (it == scope.end()) {
+            error("undeclared variable " + id->name);
+            return "";
+        }
+        id->decl = it->second;
+        return typeOf(it->second->type);
+    }
+
+    string checkCall(NMethodCall *call)
+    {
+        locate(call);
+        if (call->id->name == "parallel_for")
+            return checkParallelFor(call);
+
+        auto it = functions.find(call->id->name);
+        if (it == functions.end()) {
+            error("call of undeclared function " + call->id->name);
+            return "";
+        }
+        NFunctionDeclaration *callee = it->second;
+        call->callee = callee;
+
+        size_t expected = callee->arguments->size();
+        size_t given = call->arguments->size();
+        if (given < expected || (given > expected && !callee->isVarArg)) {
+            error("function " + call->id->name + " expects " +
+                  to_string(expected) + " arguments, " + to_string(given) +
+                  " given");
+            return "";
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < given; i++) {
+            string type = checkExpression((*call->arguments)[i]);
+            if (type.empty()) {
+                ok = false;
+                continue;
+            }
+            if (i >= expected)
+                continue;
+            string param = typeOf((*callee->arguments)[i]->type);
+            if (type != param) {
+                locate(call);
+                error("argument " + to_string(i + 1) + " of " +
+                      call->id->name + " is " + type + ", expected " + param);
+                ok = false;
+            }
+        }
+
+        auto &callees = callGraph[currentFunction];
+        if (!callee->isExtern &&
+            find(callees.begin(), callees.end(), callee) == callees.end())
+            callees.push_back(callee);
+
+        return ok ? typeOf(callee->type) : "";
+    }
+
+    string checkParallelFor(NMethodCall *call)
+    {
+        if (call->arguments->size() != 3) {
+            error("parallel_for expects lo, hi and a function, " +
+                  to_string(call->arguments->size()) + " arguments given");
+            return "";
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < 2; i++) {
+            string type = checkExpression((*call->arguments)[i]);
+            if (!type.empty() && type != "int") {
+                locate(call);
+                error("parallel_for bound is " + type + ", expected int");
+            }
+            ok = ok && type == "int";
+        }
+
+        locate(call);
+        auto id = dynamic_cast<NIdentifier *>((*call->arguments)[2]);
+        auto it = id ? functions.find(id->name) : functions.end();
+        if (it == functions.end()) {
+            error("parallel_for body must name a function");
+            return "";
+        }
+        NFunctionDeclaration *body = it->second;
+        if (body->isVarArg || body->arguments->size() != 1 ||
+            typeOf((*body->arguments)[0]->type) != "int") {
+            error("parallel_for body " + id->name +
+                  " must take exactly one int");
+            return "";
+        }
+        call->parallelBody = body;
+
+        auto &callees = callGraph[currentFunction];
+        if (!body->isExtern &&
+            find(callees.begin(), callees.end(), body) == callees.end())
+            callees.push_back(body);
+
+        return ok ? "int" : "";
+    }
+
+    void visit(NFunctionDeclaration *func, set<NFunctionDeclaration *> &visited,
+               vector<NFunctionDeclaration *> &order)
+    {
+        if (!visited.insert(func).second)
+            return;
+        for (auto callee : callGraph[func])
+            visit(callee, visited, order);
+        order.push_back(func);
+    }
+};
+
+#endif /* __SEMA_H__ */
@@ -0,0 +1,391 @@
+/*
+ * Hand written replacement of lex.l, built with `make LEXER=simd`.
+ *
+ * It returns the same tokens, prints the same trace and tracks the line
+ * and column numbers the same way, but matches the character classes of
+ * identifiers, numbers, literals and whitespace 16 (SSE2) or 32 (AVX2)
+ * bytes at a time. The widest variant the running CPU supports is picked
+ * once, when the first scanner is created.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "ASTnode.hpp"
+#include "parser.hpp"
+#include "lexer.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMDLEX_X86
+#include <immintrin.h>
+#endif
+
+/* pos is already past the token */
+#define LEX_TOKEN(tkn)                                         \
+    do {                                                       \
+        lloc->last_column = (int)((long)pos - lex->lineStart); \
+        if (lexerTrace)                                        \
+            puts("    LEX_" #tkn);                             \
+        return (lval->token = T_##tkn);                        \
+    } while (0)
+
+#define LEX_STORE_STR_TOKEN(tkn, start, len)                   \
+    do {                                                       \
+        lval->string = new std::string(start, len);            \
+        lloc->last_column = (int)((long)pos - lex->lineStart); \
+        if (lexerTrace)                                        \
+            puts("    LEX_" #tkn);                             \
+        return T_##tkn;                                        \
+    } while (0)
+
+enum CharClass {
+    CC_WHITESPACE, /* [ \t\n] */
+    CC_IDENT,      /* [a-zA-Z0-9_] */
+    CC_DIGIT,      /* [0-9] */
+    CC_LITERAL,    /* [ a-zA-Z0-9,.!$%=\\] */
+    CC_HEADER,     /* [a-zA-Z0-9.] */
+};
+
+/*
+ * The input is followed by SIMDLEX_PADDING NUL bytes. NUL is in no class,
+ * so the vector loops always stop inside the padding.
+ */
+#define SIMDLEX_PADDING 64
+
+struct SimdLexer {
+    std::string input;
+    size_t inputSize;
+    size_t pos = 0;
+    int lineno;
+    long lineStart; /* pos of column 1 of line lineno, may be negative */
+    bool terminated = false;
+};
+
+/*
+ * Returns the length of the run of class cls starting at s, and adds the
+ * newlines of a whitespace run to *lines.
+ */
+typedef size_t (*SpanFn)(const char *s, CharClass cls, int *lines);
+
+/* ------------------------- Scalar ------------------------- */
+
+static inline bool isAlnum(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9');
+}
+
+static inline bool inClass(unsigned char c, CharClass cls)
+{
+    switch (cls) {
+    case CC_WHITESPACE:
+        return c == ' ' || c == '\t' || c == '\n';
+    case CC_IDENT:
+        return isAlnum(c) || c == '_';
+    case CC_DIGIT:
+        return c >= '0' && c <= '9';
+    case CC_LITERAL:
+        return isAlnum(c) || strchr(" ,.!$%=\\", c) != nullptr;
+    case CC_HEADER:
+        return isAlnum(c) || c == '.';
+    }
+    return false;
+}
+
+static size_t spanScalar(const char *s, CharClass cls, int *lines)
+{
+    size_t n = 0;
+    /* strchr matches the terminating NUL, exclude it explicitly */
+    while (s[n] && inClass(s[n], cls)) {
+        if (s[n] == '\n')
+            (*lines)++;
+        n++;
+    }
+    return n;
+}
+
+#ifdef SIMDLEX_X86
+
+/* ------------------------- SSE2 ------------------------- */
+
+/* lo <= c <= hi, input bytes >= 0x80 are negative and never match */
+static inline __m128i rangeSSE2(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i eqSSE2(__m128i v, char c)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+static inline __m128i classSSE2(__m128i v, CharClass cls)
+{
+    __m128i digit = rangeSSE2(v, '0', '9');
+    if (cls == CC_DIGIT)
+        return digit;
+    if (cls == CC_WHITESPACE)
+        return _mm_or_si128(_mm_or_si128(eqSSE2(v, ' '), eqSSE2(v, '\t')),
+                            eqSSE2(v, '\n'));
+
+    __m128i alnum = _mm_or_si128(
+        digit,
+        _mm_or_si128(rangeSSE2(v, 'a', 'z'), rangeSSE2(v, 'A', 'Z')));
+    switch (cls) {
+    case CC_IDENT:
+        return _mm_or_si128(alnum, eqSSE2(v, '_'));
+    case CC_HEADER:
+        return _mm_or_si128(alnum, eqSSE2(v, '.'));
+    default: /* CC_LITERAL */
+        alnum = _mm_or_si128(alnum, _mm_or_si128(eqSSE2(v, ' '),
+                                                 eqSSE2(v, ',')));
+        alnum = _mm_or_si128(alnum, _mm_or_si128(eqSSE2(v, '.'),
+                                                 eqSSE2(v, '!')));
+        alnum = _mm_or_si128(alnum, _mm_or_si128(eqSSE2(v, '$'),
+                                                 eqSSE2(v, '%')));
+        return _mm_or_si128(alnum, _mm_or_si128(eqSSE2(v, '='),
+                                                eqSSE2(v, '\\')));
+    }
+}
+
+__attribute__((target("sse2"))) static size_t
+spanSSE2(const char *s, CharClass cls, int *lines)
+{
+    for (size_t n = 0;; n += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + n));
+        unsigned mask = _mm_movemask_epi8(classSSE2(v, cls));
+        unsigned len = __builtin_ctz(~mask | 0x10000);
+        if (cls == CC_WHITESPACE) {
+            unsigned nl = _mm_movemask_epi8(eqSSE2(v, '\n'));
+            *lines += __builtin_popcount(nl & ((1u << len) - 1));
+        }
+        if (len < 16)
+            return n + len;
+    }
+}
+
+/* ------------------------- AVX2 ------------------------- */
+
+__attribute__((target("avx2"))) static inline __m256i
+rangeAVX2(__m256i v, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+__attribute__((target("avx2"))) static inline __m256i eqAVX2(__m256i v,
+                                                             char c)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+classAVX2(__m256i v, CharClass cls)
+{
+    __m256i digit = rangeAVX2(v, '0', '9');
+    if (cls == CC_DIGIT)
+        return digit;
+    if (cls == CC_WHITESPACE)
+        return _mm256_or_si256(
+            _mm256_or_si256(eqAVX2(v, ' '), eqAVX2(v, '\t')),
+            eqAVX2(v, '\n'));
+
+    __m256i alnum = _mm256_or_si256(
+        digit,
+        _mm256_or_si256(rangeAVX2(v, 'a', 'z'), rangeAVX2(v, 'A', 'Z')));
+    switch (cls) {
+    case CC_IDENT:
+        return _mm256_or_si256(alnum, eqAVX2(v, '_'));
+    case CC_HEADER:
+        return _mm256_or_si256(alnum, eqAVX2(v, '.'));
+    default: /* CC_LITERAL */
+        alnum = _mm256_or_si256(alnum, _mm256_or_si256(eqAVX2(v, ' '),
+                                                       eqAVX2(v, ',')));
+        alnum = _mm256_or_si256(alnum, _mm256_or_si256(eqAVX2(v, '.'),
+                                                       eqAVX2(v, '!')));
+        alnum = _mm256_or_si256(alnum, _mm256_or_si256(eqAVX2(v, '$'),
+                                                       eqAVX2(v, '%')));
+        return _mm256_or_si256(alnum, _mm256_or_si256(eqAVX2(v, '='),
+                                                      eqAVX2(v, '\\')));
+    }
+}
+
+__attribute__((target("avx2"))) static size_t
+spanAVX2(const char *s, CharClass cls, int *lines)
+{
+    for (size_t n = 0;; n += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + n));
+        uint32_t mask = _mm256_movemask_epi8(classAVX2(v, cls));
+        unsigned len = mask == 0xffffffffu ? 32 : __builtin_ctz(~mask);
+        if (cls == CC_WHITESPACE) {
+            uint32_t nl = _mm256_movemask_epi8(eqAVX2(v, '\n'));
+            if (len < 32)
+                nl &= (1u << len) - 1;
+            *lines += __builtin_popcount(nl);
+        }
+        if (len < 32)
+            return n + len;
+    }
+}
+
+#endif /* SIMDLEX_X86 */
+
+static SpanFn span = spanScalar;
+
+static void selectSpan()
+{
+#ifdef SIMDLEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        span = spanAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        span = spanSSE2;
+#endif
+}
+
+void *lexerCreate(const char *buf, size_t len, int line, int column)
+{
+    static bool selected = (selectSpan(), true);
+    (void)selected;
+
+    SimdLexer *lex = new SimdLexer();
+    lex->input.reserve(len + SIMDLEX_PADDING);
+    lex->input.append(buf, len);
+    lex->input.append(SIMDLEX_PADDING, '\0');
+    lex->inputSize = len;
+    lex->lineno = line;
+    lex->lineStart = 1 - column;
+    return lex;
+}
+
+void lexerDestroy(void *scanner)
+{
+    delete (SimdLexer *)scanner;
+}
+
+bool lexerTerminated(void *scanner)
+{
+    return ((SimdLexer *)scanner)->terminated;
+}
+
+static inline bool startsWith(const char *s, const char *prefix)
+{
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+int lexerLex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner)
+{
+    SimdLexer *lex = (SimdLexer *)scanner;
+    size_t &pos = lex->pos;
+
+    for (;;) {
+        if (pos >= lex->inputSize)
+            return 0;
+
+        const char *s = lex->input.data() + pos;
+        size_t n;
+
+        lloc->first_line = lloc->last_line = lex->lineno;
+        lloc->first_column = (int)((long)pos - lex->lineStart) + 1;
+
+        switch (*s) {
+        case ' ':
+        case '\t':
+        case '\n': {
+            int lineno = lex->lineno;
+            n = span(s, CC_WHITESPACE, &lex->lineno);
+            if (lex->lineno != lineno)
+                lex->lineStart =
+                    pos + ((const char *)memrchr(s, '\n', n) - s) + 1;
+            pos += n;
+            continue;
+        }
+        case '*':
+            pos++;
+            LEX_TOKEN(ASTERISK);
+        case '+':
+            pos++;
+            LEX_TOKEN(ADD);
+        case '-':
+            pos++;
+            LEX_TOKEN(MINUS);
+        case '=':
+            pos++;
+            LEX_TOKEN(EQUAL);
+        case ',':
+            pos++;
+            LEX_TOKEN(COMMA);
+        case '.':
+            if (!startsWith(s, "..."))
+                break;
+            pos += 3;
+            LEX_TOKEN(ELLIPSIS);
+        case '(':
+            pos++;
+            LEX_TOKEN(LPAREN);
+        case ')':
+            pos++;
+            LEX_TOKEN(RPAREN);
+        case '{':
+            pos++;
+            LEX_TOKEN(LBRACE);
+        case '}':
+            pos++;
+            LEX_TOKEN(RBRACE);
+        case ';':
+            pos++;
+            LEX_TOKEN(SEQPOINT);
+        case '#':
+            if (startsWith(s, "#include <")) {
+                int lines = 0;
+                n = span(s + 10, CC_HEADER, &lines);
+                if (n && s[10 + n] == '>') {
+                    pos += 10 + n + 1;
+                    LEX_STORE_STR_TOKEN(HEADER, s, 10 + n + 1);
+                }
+            }
+            break;
+        case '"': {
+            int lines = 0;
+            n = span(s + 1, CC_LITERAL, &lines);
+            if (n && s[1 + n] == '"') {
+                pos += 1 + n + 1;
+                LEX_STORE_STR_TOKEN(LITERAL, s, 1 + n + 1);
+            }
+            break;
+        }
+        default: {
+            int lines = 0;
+            if (*s >= '0' && *s <= '9') {
+                n = span(s, CC_DIGIT, &lines);
+                pos += n;
+                LEX_STORE_STR_TOKEN(INTEGER, s, n);
+            }
+            if (*s != '_' && !isAlnum(*s))
+                break;
+
+            /* Keywords win over identifiers of the same length only */
+            n = span(s, CC_IDENT, &lines);
+            pos += n;
+            if (n == 6 && startsWith(s, "extern"))
+                LEX_TOKEN(EXTERN);
+            if (n == 5 && startsWith(s, "const"))
+                continue;
+            if (n == 3 && startsWith(s, "int"))
+                LEX_STORE_STR_TOKEN(INT, s, n);
+            if (n == 4 && startsWith(s, "char"))
+                LEX_STORE_STR_TOKEN(CHAR, s, n);
+            if (n == 6 && startsWith(s, "return"))
+                LEX_TOKEN(RETURN);
+            if (n == 13 && startsWith(s, "__attribute__"))
+                LEX_TOKEN(ATTRIBUTE);
+            LEX_STORE_STR_TOKEN(IDENTIFIER, s, n);
+        }
+        }
+
+        lex->terminated = true;
+        return 0;
+    }
+}
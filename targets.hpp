@@ -0,0 +1,54 @@
+#ifndef __TARGETS_H__
+#define __TARGETS_H__
+
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <mutex>
+#include <string>
+
+using namespace llvm;
+
+/*
+ * Targets are registered on first use, once: the native one for -jit and
+ * the object of the default triple, the others only when a -target names a
+ * triple the native target doesn't handle. Those need c2ir built with
+ * `make TARGETS=all`, which links every target and defines C2IR_ALL_TARGETS.
+ */
+static inline void ensureNativeTarget()
+{
+    static std::once_flag once;
+    std::call_once(once, [] {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+    });
+}
+
+/*
+ * Register the target of triple. Not thread safe against lookups of other
+ * threads, call it before emitting on several threads.
+ */
+static inline bool ensureTarget(const std::string &triple, std::string &error)
+{
+    ensureNativeTarget();
+    std::string ignored;
+    if (TargetRegistry::lookupTarget(triple, ignored))
+        return true;
+
+#ifdef C2IR_ALL_TARGETS
+    static std::once_flag once;
+    std::call_once(once, [] {
+        InitializeAllTargetInfos();
+        InitializeAllTargets();
+        InitializeAllTargetMCs();
+        InitializeAllAsmPrinters();
+    });
+    return TargetRegistry::lookupTarget(triple, error) != nullptr;
+#else
+    error = "no target for " + triple + ", c2ir is built for the native " +
+            "target only (make TARGETS=all)";
+    return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,28 @@
+extern int puts(const char *str);
+extern int printf(const char *str, ...);
+
+int line(int i)
+{
+    printf("line %d of the io test, 100%% buffered%c", i, 10);
+    return 0;
+}
+
+int main()
+{
+    int zero = 0;
+    int max = 2147483647;
+    int min = zero - max;
+    char *format = "%d and %d%c";
+
+    min = min - 1;
+    echo(min);
+    echo(max);
+    printf("%d %i %c%s%c", min, max, 65, " and text", 10);
+    printf("%x %5d%c", 255, 42, 10);
+    printf(format, min, 2, 10);
+    printf("100%%%c", 10);
+    puts("puts");
+
+    parallel_for(0, 5000, line);
+    return 0;
+}
@@ -0,0 +1,31 @@
+int step(int i)
+{
+    echo(i);
+    return 0;
+}
+
+int times10(int x)
+{
+    int x2 = x + x;
+    int x4 = x2 + x2;
+    int x8 = x4 + x4;
+    return x8 + x2;
+}
+
+int row(int i)
+{
+    int lo = times10(i);
+    lo = lo + 1000;
+    parallel_for(lo, lo + 10, step);
+    return 0;
+}
+
+int main()
+{
+    parallel_for(0, 1000, step);
+    parallel_for(0, 10, row);
+
+    parallel_for(5, 5, step);
+    parallel_for(7, 3, step);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#!/bin/sh
+#
+# Runtime tests: the programs here are compiled by c2ir at -O0 and -O2,
+# linked against libc2ir_rt.a and run.
+#
+#   parallel    parallel_for over [0, 1000), over ten nested ranges of ten
+#               from 1000 and over empty ranges must run every index once,
+#               with 1 to 64 pool threads
+#   io          echo, printf and puts through the buffered writers of
+#               runtime/io.c must write the bytes libc does with
+#               -buffered-io=false: INT_MIN, %%, the c2ir_printf fallback of
+#               other conversions and of a variable format, and lines over
+#               a buffer (64 KiB), many of them and one longer than it
+#
+#   ./run.sh
+#
+# C2IR, TEST_CC (the C compiler, clang by default), RUNTIME (libc2ir_rt.a)
+# and OUT may be set in the environment.
+
+set -e
+
+cd "$(dirname "$0")"
+
+C2IR=${C2IR:-$(pwd)/../c2ir}
+CC=${TEST_CC:-clang}
+RUNTIME=${RUNTIME:-$(pwd)/../libc2ir_rt.a}
+OUT=${OUT:-out}
+TESTS=$(pwd)
+
+if [ ! -x "$C2IR" ]; then
+    echo "$C2IR not found, run make first" >&2
+    exit 1
+fi
+
+mkdir -p "$OUT"
+
+# build src bin [c2ir options]: compile src with c2ir and link $OUT/bin
+build()
+{
+    src=$1
+    bin=$2
+    shift 2
+    # c2ir always writes text.o next to where it runs
+    (cd "$OUT" && "$C2IR" "$@" "$src" > "$bin.log" 2>&1 &&
+        mv text.o "$bin.o") || {
+        echo "$C2IR failed on $src, see $OUT/$bin.log" >&2
+        exit 1
+    }
+    $CC -o "$OUT/$bin" "$OUT/$bin.o" "$RUNTIME" -lpthread
+}
+
+fail()
+{
+    echo "FAIL $*" >&2
+    exit 1
+}
+
+seq 0 1099 > "$OUT/parallel.expected"
+for opt in O0 O2; do
+    build "$TESTS/parallel.c" "parallel.$opt" -$opt
+    for threads in 1 2 8 64; do
+        C2IR_NUM_THREADS=$threads "$OUT/parallel.$opt" |
+            sort -n > "$OUT/parallel.out"
+        cmp -s "$OUT/parallel.out" "$OUT/parallel.expected" ||
+            fail "parallel -$opt with $threads threads"
+    done
+done
+echo "ok parallel"
+
+# Lines longer than a buffer, after a short one so the buffer isn't empty,
+# written at once by puts and %s and formatted aside by c2ir_printf. The
+# lexer has no escapes, printf ends the lines with %c.
+long=$(head -c 100000 /dev/zero | tr '\0' x)
+cat > "$OUT/longline.c" <<EOF
+extern int puts(const char *str);
+extern int printf(const char *str, ...);
+
+int main()
+{
+    char *line = "$long";
+
+    puts("short");
+    puts(line);
+    printf("%s%c", line, 10);
+    printf("%8s%c", line, 10);
+    return 0;
+}
+EOF
+
+# With one pool thread, parallel_for runs the lines in order
+for src in "$TESTS/io.c" "$OUT/longline.c"; do
+    name=$(basename "$src" .c)
+    for opt in O0 O2; do
+        build "$src" "$name.$opt" -$opt
+        build "$src" "$name.$opt.libc" -$opt -buffered-io=false
+        C2IR_NUM_THREADS=1 "$OUT/$name.$opt" > "$OUT/$name.out"
+        C2IR_NUM_THREADS=1 "$OUT/$name.$opt.libc" > "$OUT/$name.libc.out"
+        cmp "$OUT/$name.out" "$OUT/$name.libc.out" ||
+            fail "$name -$opt differs from -buffered-io=false"
+    done
+done
+echo "ok io"